@@ -536,16 +536,19 @@ int unlzma_main(int argc UNUSED_PARAM, char **argv)
 
 
 //usage:#define unxz_trivial_usage
-//usage:       "[-cfk] [FILE]..."
+//usage:       "[-cfk" IF_FEATURE_XZ_PARALLEL("] [-T N") "] [FILE]..."
 //usage:#define unxz_full_usage "\n\n"
 //usage:       "Decompress FILEs (or stdin)\n"
 //usage:     "\n	-c	Write to stdout"
 //usage:     "\n	-f	Force"
 //usage:     "\n	-k	Keep input files"
 //usage:     "\n	-t	Test integrity"
+//usage:	IF_FEATURE_XZ_PARALLEL(
+//usage:     "\n	-T N	Decode up to N blocks in parallel (0: one per CPU)"
+//usage:	)
 //usage:
 //usage:#define xz_trivial_usage
-//usage:       "-d [-cfk] [FILE]..."
+//usage:       "-d [-cfk" IF_FEATURE_XZ_PARALLEL("] [-T N") "] [FILE]..."
 //usage:#define xz_full_usage "\n\n"
 //usage:       "Decompress FILEs (or stdin)\n"
 //usage:     "\n	-d	Decompress"
@@ -553,6 +556,9 @@ int unlzma_main(int argc UNUSED_PARAM, char **argv)
 //usage:     "\n	-f	Force"
 //usage:     "\n	-k	Keep input files"
 //usage:     "\n	-t	Test integrity"
+//usage:	IF_FEATURE_XZ_PARALLEL(
+//usage:     "\n	-T N	Decode up to N blocks in parallel (0: one per CPU)"
+//usage:	)
 //usage:
 //usage:#define xzcat_trivial_usage
 //usage:       "[FILE]..."
@@ -589,7 +595,16 @@ int unlzma_main(int argc UNUSED_PARAM, char **argv)
 int unxz_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int unxz_main(int argc UNUSED_PARAM, char **argv)
 {
-	IF_XZ(int opts =) getopt32(argv, BBUNPK_OPTSTR "dt");
+	IF_XZ(int opts;)
+
+	/* -T 0 is "one per CPU", no -T is serial */
+	IF_FEATURE_XZ_PARALLEL(xz_jobs = 1;)
+	IF_XZ(opts =) getopt32(argv, BBUNPK_OPTSTR "dt" IF_FEATURE_XZ_PARALLEL("T:+")
+			IF_FEATURE_XZ_PARALLEL(, &xz_jobs));
+#if ENABLE_FEATURE_XZ_PARALLEL
+	if (xz_jobs == 0)
+		xz_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
 # if ENABLE_XZ
 	/* xz without -d or -t? */
 	if (applet_name[2] == '\0' && !(opts & (BBUNPK_OPT_DECOMPRESS|BBUNPK_OPT_TEST)))
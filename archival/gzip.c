@@ -55,6 +55,15 @@ aa:      85.1% -- replaced with aa.gz
 //config:	If this option is not selected, -N options are ignored and -6
 //config:	is used.
 //config:
+//config:config FEATURE_GZIP_PARALLEL
+//config:	bool "Enable parallel compression (-p N)"
+//config:	default y
+//config:	depends on GZIP && PLATFORM_POSIX && !NOMMU
+//config:	help
+//config:	Enable -p N option to compress using N processes. Input is
+//config:	split into 128k chunks which are compressed independently,
+//config:	so compression is slightly worse than with one process.
+//config:
 //config:config FEATURE_GZIP_DECOMPRESS
 //config:	bool "Enable decompression"
 //config:	default y
@@ -69,7 +78,8 @@ aa:      85.1% -- replaced with aa.gz
 //kbuild:lib-$(CONFIG_GZIP) += gzip.o
 
 //usage:#define gzip_trivial_usage
-//usage:       "[-cfk" IF_FEATURE_GZIP_DECOMPRESS("dt") IF_FEATURE_GZIP_LEVELS("123456789") "] [FILE]..."
+//usage:       "[-cfk" IF_FEATURE_GZIP_DECOMPRESS("dt") IF_FEATURE_GZIP_LEVELS("123456789") "]"
+//usage:       IF_FEATURE_GZIP_PARALLEL(" [-p N]") " [FILE]..."
 //usage:#define gzip_full_usage "\n\n"
 //usage:       "Compress FILEs (or stdin)\n"
 //usage:	IF_FEATURE_GZIP_LEVELS(
@@ -81,6 +91,9 @@ aa:      85.1% -- replaced with aa.gz
 //usage:     "\n	-c	Write to stdout"
 //usage:     "\n	-f	Force"
 //usage:     "\n	-k	Keep input files"
+//usage:	IF_FEATURE_GZIP_PARALLEL(
+//usage:     "\n	-p N	Compress using N processes"
+//usage:	)
 //usage:	IF_FEATURE_GZIP_DECOMPRESS(
 //usage:     "\n	-t	Test integrity"
 //usage:	)
@@ -348,6 +361,9 @@ struct globals {
 #define good_match        (G1.good_match)
 #define nice_match        (G1.nice_match)
 #endif
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	unsigned jobs;	/* number of processes to compress with */
+#endif
 
 /* =========================================================================== */
 /* all members below are zeroed out in pack_gzip() for each next file */
@@ -391,6 +407,15 @@ struct globals {
 	unsigned outcnt;	/* bytes in output buffer */
 	smallint eofile;	/* flag set at end of input file */
 
+#if ENABLE_FEATURE_GZIP_PARALLEL
+/* In a worker process input is read from memory rather than ifd, and
+ * unless this is the last chunk deflate() ends with a sync flush.
+ */
+	const uch *in_ptr;
+	unsigned in_left;
+	smallint partial;
+#endif
+
 /* ===========================================================================
  * Local data used by the "bit string" routines.
  */
@@ -525,6 +550,14 @@ static unsigned file_read(void *buf, unsigned size)
 
 	Assert(G1.insize == 0, "l_buf not empty");
 
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	if (G1.in_ptr) {
+		len = MIN(size, G1.in_left);
+		memcpy(buf, G1.in_ptr, len);
+		G1.in_ptr += len;
+		G1.in_left -= len;
+	} else
+#endif
 	len = safe_read(ifd, buf, size);
 	if (len == (unsigned)(-1) || len == 0)
 		return len;
@@ -1908,6 +1941,16 @@ static NOINLINE void deflate(void)
 	if (match_available)
 		ct_tally(0, G1.window[G1.strstart - 1]);
 
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	if (G1.partial) {
+		/* More chunks follow: end with an empty stored block,
+		 * which leaves the output aligned on a byte boundary */
+		FLUSH_BLOCK(0);
+		send_bits(STORED_BLOCK << 1, 3);
+		copy_block(NULL, 0, 1);
+		return;
+	}
+#endif
 	FLUSH_BLOCK(1);	/* eof */
 }
 
@@ -1922,11 +1965,13 @@ static void bi_init(void)
 }
 
 /* ===========================================================================
- * Initialize the "longest match" routines for a new file
+ * Initialize the "longest match" routines for a new file.
+ * window[0..strstart-1] may hold a preset dictionary.
  */
 static void lm_init(void)
 {
 	unsigned j;
+	IPos hash_head;
 
 	/* Initialize the hash table. */
 	memset(head, 0, HASH_SIZE * sizeof(*head));
@@ -1937,8 +1982,8 @@ static void lm_init(void)
 	//G1.strstart = 0; // globals are zeroed in pack_gzip()
 	//G1.block_start = 0L; // globals are zeroed in pack_gzip()
 
-	G1.lookahead = file_read(G1.window,
-			sizeof(int) <= 2 ? (unsigned) WSIZE : 2 * WSIZE);
+	G1.lookahead = file_read(G1.window + G1.strstart,
+			(sizeof(int) <= 2 ? (unsigned) WSIZE : 2 * WSIZE) - G1.strstart);
 
 	if (G1.lookahead == 0 || G1.lookahead == (unsigned) -1) {
 		G1.eofile = 1;
@@ -1958,6 +2003,10 @@ static void lm_init(void)
 	/* If lookahead < MIN_MATCH, ins_h is garbage, but this is
 	 * not important since only literal bytes will be emitted.
 	 */
+
+	/* Insert the strings of the dictionary in the hash table */
+	for (j = 0; j < G1.strstart; j++)
+		INSERT_STRING(j, hash_head);
 }
 
 /* ===========================================================================
@@ -2057,6 +2106,126 @@ static void ct_init(void)
 	init_block();
 }
 
+#if ENABLE_FEATURE_GZIP_PARALLEL
+/* ===========================================================================
+ * Parallel compression.  The input is split into chunks which are deflated
+ * by child processes, each using the last WSIZE bytes of input before its
+ * chunk as a preset dictionary.  All but the last chunk end with an empty
+ * stored block so the compressed chunks can simply be concatenated.
+ * Each worker sends its compressed data followed by the crc of its chunk.
+ */
+#define CHUNK_SIZE (128 * 1024)
+
+struct worker {
+	pid_t pid;
+	int fd;		/* compressed data from worker */
+	unsigned len;	/* uncompressed length of chunk */
+};
+
+/* buf holds dlen bytes of dictionary followed by len bytes of input */
+static void start_worker(struct worker *w, const uch *buf,
+		unsigned dlen, unsigned len, int last)
+{
+	struct fd_pair pipe;
+
+	xpiped_pair(pipe);
+#ifdef F_SETPIPE_SZ
+	/* Let the worker finish without waiting for us to read its output */
+	fcntl(pipe.wr, F_SETPIPE_SZ, CHUNK_SIZE);
+#endif
+	w->pid = xfork();
+	if (w->pid == 0) {
+		close(pipe.rd);
+		xmove_fd(pipe.wr, ofd);
+
+		memcpy(G1.window, buf, dlen);
+		G1.strstart = G1.block_start = dlen;
+		G1.in_ptr = buf + dlen;
+		G1.in_left = len;
+		G1.partial = !last;
+
+		lm_init();
+		deflate();
+		flush_outbuf();
+		G1.crc = ~G1.crc;
+		xwrite(ofd, &G1.crc, 4);
+		_exit(EXIT_SUCCESS);
+	}
+	close(pipe.wr);
+	w->fd = pipe.rd;
+	w->len = len;
+}
+
+/* Copy the output of the worker and combine its crc with ours */
+static uint32_t finish_worker(struct worker *w, uint32_t crc)
+{
+	size_t size = INT_MAX;
+	uch *data;
+	uint32_t wcrc;
+	int status;
+
+	data = xmalloc_read(w->fd, &size);
+	close(w->fd);
+	if (safe_waitpid(w->pid, &status, 0) < 0 || status != 0 || size < 4)
+		bb_simple_error_msg_and_die("worker failed");
+
+	size -= 4;
+	xwrite(ofd, data, size);
+	move_from_unaligned32(wcrc, data + size);
+	free(data);
+	return crc32_combine_le(crc, wcrc, w->len);
+}
+
+static void zip_parallel(void)
+{
+	struct worker *workers = xzalloc(G1.jobs * sizeof(workers[0]));
+	uch *buf = xmalloc(WSIZE + CHUNK_SIZE);
+	unsigned dlen = 0, first = 0, running = 0;
+	uint32_t crc = 0;
+	ssize_t len;
+
+	/* Workers mustn't repeat the header */
+	flush_outbuf();
+
+	for (;;) {
+		len = full_read(ifd, buf + dlen, CHUNK_SIZE);
+		if (len < 0)
+			bb_simple_perror_msg_and_die(bb_msg_read_error);
+		if (len == 0)
+			break;
+		if (running == G1.jobs) {
+			crc = finish_worker(&workers[first], crc);
+			first = (first + 1) % G1.jobs;
+			running--;
+		}
+		start_worker(&workers[(first + running) % G1.jobs],
+				buf, dlen, len, len < CHUNK_SIZE);
+		running++;
+		G1.isize += len;
+		if (len < CHUNK_SIZE)
+			break;
+
+		/* Keep the end of the input as the next dictionary */
+		memmove(buf, buf + dlen + len - WSIZE, WSIZE);
+		dlen = WSIZE;
+	}
+
+	while (running) {
+		crc = finish_worker(&workers[first], crc);
+		first = (first + 1) % G1.jobs;
+		running--;
+	}
+	/* If the last chunk was full (or there was no input) send an empty
+	 * final block: static trees with just the end of block code */
+	if (len == 0)
+		put_16bit(0x0003);
+
+	G1.crc = ~crc;
+	free(buf);
+	free(workers);
+}
+#endif
+
 /* ===========================================================================
  * Deflate in to out.
  * IN assertions: the input and output buffers are cleared.
@@ -2079,7 +2248,6 @@ static void zip(void)
 
 	bi_init();
 	ct_init();
-	lm_init();
 
 	deflate_flags = 0x300; /* extra flags. OS id = 3 (Unix) */
 #if ENABLE_FEATURE_GZIP_LEVELS
@@ -2093,7 +2261,15 @@ static void zip(void)
 	/* The above 32-bit misaligns outbuf (10 bytes are stored), flush it */
 	flush_outbuf_if_32bit_optimized();
 
-	deflate();
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	if (G1.jobs > 1)
+		zip_parallel();
+	else
+#endif
+	{
+		lm_init();
+		deflate();
+	}
 
 	/* Write the crc and uncompressed size */
 	put_32bit(~G1.crc);
@@ -2174,6 +2350,9 @@ static const char gzip_longopts[] ALIGN1 =
 	"fast\0"                No_argument       "1"
 	"best\0"                No_argument       "9"
 	"no-name\0"             No_argument       "n"
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	"processes\0"           Required_argument "p"
+#endif
 	;
 #endif
 
@@ -2223,16 +2402,20 @@ int gzip_main(int argc UNUSED_PARAM, char **argv)
 
 	/* Must match bbunzip's constants OPT_STDOUT, OPT_FORCE! */
 #if ENABLE_FEATURE_GZIP_LONG_OPTIONS
-	opt = getopt32long(argv, BBUNPK_OPTSTR IF_FEATURE_GZIP_DECOMPRESS("dt") "n123456789", gzip_longopts);
+	opt = getopt32long(argv, BBUNPK_OPTSTR IF_FEATURE_GZIP_DECOMPRESS("dt") "n"
+			IF_FEATURE_GZIP_PARALLEL("p:+") "123456789", gzip_longopts
+			IF_FEATURE_GZIP_PARALLEL(, &G1.jobs));
 #else
-	opt = getopt32(argv, BBUNPK_OPTSTR IF_FEATURE_GZIP_DECOMPRESS("dt") "n123456789");
+	opt = getopt32(argv, BBUNPK_OPTSTR IF_FEATURE_GZIP_DECOMPRESS("dt") "n"
+			IF_FEATURE_GZIP_PARALLEL("p:+") "123456789"
+			IF_FEATURE_GZIP_PARALLEL(, &G1.jobs));
 #endif
 #if ENABLE_FEATURE_GZIP_DECOMPRESS /* gunzip_main may not be visible... */
 	if (opt & (BBUNPK_OPT_DECOMPRESS|BBUNPK_OPT_TEST)) /* -d and/or -t */
 		return gunzip_main(argc, argv);
 #endif
 #if ENABLE_FEATURE_GZIP_LEVELS
-	opt >>= (BBUNPK_OPTSTRLEN IF_FEATURE_GZIP_DECOMPRESS(+ 2) + 1); /* drop cfkvq[dt]n bits */
+	opt >>= (BBUNPK_OPTSTRLEN IF_FEATURE_GZIP_DECOMPRESS(+ 2) + 1 IF_FEATURE_GZIP_PARALLEL(+ 1)); /* drop cfkvq[dt]n[p] bits */
 	if (opt == 0)
 		opt = 1 << 5; /* default: 6 */
 	opt = ffs(opt >> 4); /* Maps -1..-4 to [0], -5 to [1] ... -9 to [5] */
@@ -525,6 +525,126 @@ static void inflate_codes_setup(STATE_PARAM unsigned my_bl, unsigned my_bd)
 	ml = mask_bits[bl];		/* precompute masks for speed */
 	md = mask_bits[bd];
 }
+#if ENABLE_FEATURE_INFLATE_FAST
+/* Bytes of input the fast loop wants buffered: one 64-bit refill
+ * plus slack, and of window space: one maximal match */
+enum { FAST_MIN_IN = 16, FAST_MIN_OUT = 258 };
+
+/* Decode with a 64-bit bit buffer refilled straight from bytebuffer[],
+ * while no window flush or buffer read can be needed.
+ * Returns 1 if end of block was reached. On return, bit buffer holds
+ * less than 8 bits, unused whole bytes are given back to bytebuffer[].
+ */
+static int inflate_codes_fast(STATE_PARAM_ONLY)
+{
+	const uint8_t *in = bytebuffer + bytebuffer_offset;
+	const uint8_t *in_last = bytebuffer + bytebuffer_size - FAST_MIN_IN;
+	uint8_t *win = gunzip_window;
+	uint64_t hold = bb;
+	unsigned bits = k;
+	unsigned ww = w;
+	unsigned e, len, distance;
+	huft_t *t;
+	int eob = 0;
+
+	while (in <= in_last && ww < GUNZIP_WSIZE - FAST_MIN_OUT) {
+		uint64_t v;
+
+		/* Load 8 bytes, keep the whole ones which fit: 56..63 bits.
+		 * Codes, extra bits and distance need at most 48 */
+		move_from_unaligned64(v, in);
+		hold |= SWAP_LE64(v) << bits;
+		in += (63 - bits) >> 3;
+		bits |= 56;
+
+		t = tl + ((unsigned)hold & ml);
+		e = t->e;
+		while (e > 16) {
+			if (e == 99)
+				abort_unzip(PASS_STATE_ONLY);
+			hold >>= t->b;
+			bits -= t->b;
+			e -= 16;
+			t = t->v.t + ((unsigned)hold & mask_bits[e]);
+			e = t->e;
+		}
+		hold >>= t->b;
+		bits -= t->b;
+		if (e == 16) {	/* literal */
+			win[ww++] = (uint8_t)t->v.n;
+			continue;
+		}
+		if (e == 15) {	/* end of block */
+			eob = 1;
+			break;
+		}
+		len = t->v.n + ((unsigned)hold & mask_bits[e]);
+		hold >>= e;
+		bits -= e;
+
+		t = td + ((unsigned)hold & md);
+		e = t->e;
+		while (e > 16) {
+			if (e == 99)
+				abort_unzip(PASS_STATE_ONLY);
+			hold >>= t->b;
+			bits -= t->b;
+			e -= 16;
+			t = t->v.t + ((unsigned)hold & mask_bits[e]);
+			e = t->e;
+		}
+		hold >>= t->b;
+		bits -= t->b;
+		distance = t->v.n + ((unsigned)hold & mask_bits[e]);
+		hold >>= e;
+		bits -= e;
+
+		/* len <= FAST_MIN_OUT: the copy never reaches window end */
+		if (distance > ww) {
+			/* source wraps around the window, rare */
+			unsigned d = ww - distance;
+			do {
+				win[ww++] = win[d++ & (GUNZIP_WSIZE - 1)];
+			} while (--len);
+		} else if (distance >= len) {
+			memcpy(win + ww, win + ww - distance, len);
+			ww += len;
+		} else if (distance >= 8) {
+			/* overlapping, but 8 bytes at a time is safe */
+			uint8_t *dst = win + ww;
+			ww += len;
+			while (len >= 8) {
+				move_from_unaligned64(v, dst - distance);
+				move_to_unaligned64(dst, v);
+				dst += 8;
+				len -= 8;
+			}
+			while (len) {
+				*dst = dst[-(int)distance];
+				dst++;
+				len--;
+			}
+		} else {
+			uint8_t *dst = win + ww;
+			ww += len;
+			do {
+				*dst = dst[-(int)distance];
+				dst++;
+			} while (--len);
+		}
+	}
+
+	/* Give back the whole bytes we hold */
+	in -= bits >> 3;
+	bits &= 7;
+	bytebuffer_offset = in - bytebuffer;
+	bb = (unsigned)hold & ((1 << bits) - 1);
+	k = bits;
+	w = ww;
+	return eob;
+}
+#endif
+
 /* called once from inflate_get_next_window */
 static NOINLINE int inflate_codes(STATE_PARAM_ONLY)
 {
@@ -535,6 +655,15 @@ static NOINLINE int inflate_codes(STATE_PARAM_ONLY)
 		goto do_copy;
 
 	while (1) {			/* do until end of block */
+#if ENABLE_FEATURE_INFLATE_FAST
+		if (w < GUNZIP_WSIZE - FAST_MIN_OUT
+		 && bytebuffer_size - bytebuffer_offset > FAST_MIN_IN
+		) {
+			if (inflate_codes_fast(PASS_STATE_ONLY))
+				break;
+			continue;
+		}
+#endif
 		bb = fill_bitbuffer(PASS_STATE bb, &k, bl);
 		t = tl + ((unsigned) bb & ml);
 		e = t->e;
@@ -42,6 +42,372 @@ static uint32_t xz_crc32(const uint8_t *buf, size_t size, uint32_t crc)
 #include "unxz/xz_dec_lzma2.c"
 #include "unxz/xz_dec_stream.c"
 
+#if ENABLE_FEATURE_XZ_PARALLEL
+/* Decoding of seekable single-stream files with several blocks
+ * (as written by "xz -T N") in parallel: the Index at the end of the
+ * stream gives position and sizes of every block. Blocks are decoded
+ * by child processes, each sends its fully verified output over a pipe,
+ * and we copy the output to dst_fd in order. If a child can't be
+ * started, or runs out of memory, we decode the rest ourselves.
+ */
+unsigned xz_jobs;
+
+/* Give up on files with unreasonably large Index or blocks */
+#define XZ_MAX_INDEX (1024*1024)
+#define XZ_MAX_BLOCK (256*1024*1024)
+/* Children hold a whole block in memory: limit the sum of these */
+#define XZ_MAX_MEM   (512*1024*1024)
+
+/* Child exit code: block is not decoded, and nothing was sent */
+#define XZ_EXIT_RETRY 2
+
+struct xz_block {
+	off_t offset;
+	vli_type unpadded;
+	vli_type uncompressed;
+};
+
+struct xz_worker {
+	pid_t pid;
+	int fd;
+};
+
+static const uint8_t *get_vli(const uint8_t *p, const uint8_t *end, vli_type *v)
+{
+	unsigned shift = 0;
+
+	*v = 0;
+	while (p < end && shift < VLI_BYTES_MAX * 7) {
+		uint8_t c = *p++;
+		*v |= (vli_type)(c & 0x7f) << shift;
+		if (!(c & 0x80))
+			return (c == 0 && shift != 0) ? NULL : p;
+		shift += 7;
+	}
+	return NULL;
+}
+
+/* Read and verify Index of the stream starting at offset start
+ * and ending at the end of the file. Returns NULL if there is none,
+ * or the stream isn't worth decoding in parallel.
+ */
+static struct xz_block *read_xz_index(int fd, off_t start,
+		uint8_t *header, unsigned *count)
+{
+	struct stat st;
+	uint8_t footer[STREAM_HEADER_SIZE];
+	uint8_t *index;
+	const uint8_t *p, *end;
+	struct xz_block *blocks = NULL;
+	uint32_t index_size;
+	off_t pos, index_start;
+	vli_type n;
+	unsigned i;
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)
+	 || st.st_size < start + 2 * STREAM_HEADER_SIZE
+	 || pread(fd, header, STREAM_HEADER_SIZE, start) != STREAM_HEADER_SIZE
+	 || pread(fd, footer, STREAM_HEADER_SIZE, st.st_size - STREAM_HEADER_SIZE) != STREAM_HEADER_SIZE
+	 || memcmp(header, HEADER_MAGIC, HEADER_MAGIC_SIZE) != 0
+	 || memcmp(footer + 10, FOOTER_MAGIC, FOOTER_MAGIC_SIZE) != 0
+	 || memcmp(footer + 8, header + HEADER_MAGIC_SIZE, 2) != 0
+	 || xz_crc32(footer + 4, 6, 0) != get_unaligned_le32(footer)
+	) {
+		return NULL;
+	}
+	index_size = (get_unaligned_le32(footer + 4) + 1) * 4;
+	index_start = st.st_size - STREAM_HEADER_SIZE - index_size;
+	if (index_size > XZ_MAX_INDEX || index_start < start + STREAM_HEADER_SIZE)
+		return NULL;
+
+	index = xmalloc(index_size);
+	if (pread(fd, index, index_size, index_start) != index_size
+	 || index[0] != 0
+	 || xz_crc32(index, index_size - 4, 0) != get_unaligned_le32(index + index_size - 4)
+	) {
+		goto ret;
+	}
+	end = index + index_size - 4;
+	p = get_vli(index + 1, end, &n);
+	/* A record takes at least two bytes */
+	if (!p || n < 2 || n > (end - p) / 2)
+		goto ret;
+
+	blocks = xmalloc(n * sizeof(blocks[0]));
+	pos = start + STREAM_HEADER_SIZE;
+	for (i = 0; i < n; i++) {
+		p = get_vli(p, end, &blocks[i].unpadded);
+		if (p)
+			p = get_vli(p, end, &blocks[i].uncompressed);
+		if (!p
+		 || blocks[i].unpadded == 0
+		 || blocks[i].unpadded > index_start - pos
+		 || blocks[i].unpadded > XZ_MAX_BLOCK
+		 || blocks[i].uncompressed > XZ_MAX_BLOCK
+		) {
+			goto bad;
+		}
+		blocks[i].offset = pos;
+		pos += (blocks[i].unpadded + 3) & ~(vli_type)3;
+	}
+	/* Index Padding, and the blocks must fill the space before Index */
+	while (p < end)
+		if (*p++ != 0)
+			goto bad;
+	if ((p - index) & 3 || pos != index_start)
+		goto bad;
+	*count = n;
+	goto ret;
+ bad:
+	free(blocks);
+	blocks = NULL;
+ ret:
+	free(index);
+	return blocks;
+}
+
+/* Memory a child needs for the block: all its input and output */
+static size_t xz_block_mem(const struct xz_block *blk)
+{
+	return STREAM_HEADER_SIZE + ((blk->unpadded + 3) & ~(vli_type)3)
+		+ blk->uncompressed;
+}
+
+/* Child: decode one block and send it to fd */
+static void NORETURN decode_xz_block(int fd, int out_fd,
+		const uint8_t *header, const struct xz_block *blk)
+{
+	struct xz_buf iobuf;
+	struct xz_dec *s;
+	enum xz_ret ret;
+	uint8_t *buf;
+	size_t in_size;
+
+	in_size = STREAM_HEADER_SIZE + ((blk->unpadded + 3) & ~(vli_type)3);
+	/* Not xmalloc: if we can't, the parent will do it */
+	buf = malloc(in_size + blk->uncompressed);
+	if (!buf)
+		_exit(XZ_EXIT_RETRY);
+	memcpy(buf, header, STREAM_HEADER_SIZE);
+	if (pread(fd, buf + STREAM_HEADER_SIZE, in_size - STREAM_HEADER_SIZE,
+			blk->offset) != in_size - STREAM_HEADER_SIZE)
+		_exit(XZ_EXIT_RETRY);
+
+	memset(&iobuf, 0, sizeof(iobuf));
+	iobuf.in = buf;
+	iobuf.in_size = in_size;
+	iobuf.out = buf + in_size;
+	iobuf.out_size = blk->uncompressed;
+	s = xz_dec_init(XZ_DYNALLOC, 64*1024*1024);
+	if (!s)
+		_exit(XZ_EXIT_RETRY);
+	do
+		ret = xz_dec_run(s, &iobuf);
+	while (ret == XZ_UNSUPPORTED_CHECK);
+	if (ret == XZ_MEM_ERROR)
+		_exit(XZ_EXIT_RETRY);
+
+	/* All input used, the block (and its check) is complete
+	 * and matches its Index record */
+	if (ret != XZ_OK
+	 || s->sequence != SEQ_BLOCK_START
+	 || iobuf.in_pos != in_size
+	 || s->block.hash.unpadded != blk->unpadded
+	 || s->block.hash.uncompressed != blk->uncompressed
+	) {
+		_exit(EXIT_FAILURE);
+	}
+	xwrite(out_fd, iobuf.out, iobuf.out_pos);
+	_exit(EXIT_SUCCESS);
+}
+
+/* Returns -1 if no process or pipe could be created */
+static int start_xz_worker(struct xz_worker *w, int fd,
+		const uint8_t *header, const struct xz_block *blk)
+{
+	int fds[2];
+
+	if (pipe(fds) != 0)
+		return -1;
+	w->pid = fork();
+	if (w->pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	if (w->pid == 0) {
+		close(fds[0]);
+		decode_xz_block(fd, fds[1], header, blk);
+	}
+	close(fds[1]);
+	w->fd = fds[0];
+	return 0;
+}
+
+/* Copy the output of the worker. Return 0 if it is complete,
+ * 1 if the worker failed before sending anything (the block may
+ * be fine, we ran out of memory or got killed), -1 if it's corrupted.
+ */
+static int finish_xz_worker(transformer_state_t *xstate, struct xz_worker *w,
+		const struct xz_block *blk, uint8_t *buf)
+{
+	vli_type total = 0;
+	int status;
+
+	for (;;) {
+		ssize_t rd = safe_read(w->fd, buf, BUFSIZ);
+		if (rd <= 0)
+			break;
+		xtransformer_write(xstate, buf, rd);
+		total += rd;
+	}
+	close(w->fd);
+	if (safe_waitpid(w->pid, &status, 0) < 0)
+		return -1;
+	if (status != 0) {
+		if (total == 0
+		 && (WIFSIGNALED(status) || WEXITSTATUS(status) == XZ_EXIT_RETRY)
+		) {
+			return 1;
+		}
+		return -1;
+	}
+	return -(total != blk->uncompressed);
+}
+
+static void stop_xz_workers(struct xz_worker *workers, unsigned jobs,
+		unsigned from, unsigned to)
+{
+	while (from < to) {
+		struct xz_worker *w = &workers[from++ % jobs];
+		kill(w->pid, SIGKILL);
+		close(w->fd);
+		safe_waitpid(w->pid, NULL, 0);
+	}
+}
+
+/* Decode one block in this process, writing the output as we go.
+ * Returns 0 if the block is complete and matches its Index record.
+ */
+static int unpack_xz_block(transformer_state_t *xstate,
+		const uint8_t *header, const struct xz_block *blk, uint8_t *buf)
+{
+	struct xz_buf iobuf;
+	struct xz_dec *s;
+	enum xz_ret ret;
+	off_t pos = blk->offset;
+	vli_type left = (blk->unpadded + 3) & ~(vli_type)3;
+	int full;
+	int bad = 1;
+
+	s = xz_dec_init(XZ_DYNALLOC, 64*1024*1024);
+	if (!s)
+		bb_die_memory_exhausted();
+	memset(&iobuf, 0, sizeof(iobuf));
+	memcpy(buf, header, STREAM_HEADER_SIZE);
+	iobuf.in = buf;
+	iobuf.in_size = STREAM_HEADER_SIZE;
+	iobuf.out = buf + BUFSIZ;
+	iobuf.out_size = BUFSIZ;
+	do {
+		if (iobuf.in_pos == iobuf.in_size && left != 0) {
+			ssize_t rd = pread(xstate->src_fd, buf, MIN(left, BUFSIZ), pos);
+			if (rd <= 0)
+				goto ret;
+			pos += rd;
+			left -= rd;
+			iobuf.in_pos = 0;
+			iobuf.in_size = rd;
+		}
+		ret = xz_dec_run(s, &iobuf);
+		/* Output may be pending after all input is used */
+		full = (iobuf.out_pos == iobuf.out_size);
+		if (iobuf.out_pos) {
+			xtransformer_write(xstate, iobuf.out, iobuf.out_pos);
+			iobuf.out_pos = 0;
+		}
+		if (ret == XZ_MEM_ERROR)
+			bb_die_memory_exhausted();
+		if (ret != XZ_OK && ret != XZ_UNSUPPORTED_CHECK)
+			goto ret;
+	} while (left != 0 || iobuf.in_pos != iobuf.in_size || full);
+
+	if (s->sequence == SEQ_BLOCK_START
+	 && s->block.hash.unpadded == blk->unpadded
+	 && s->block.hash.uncompressed == blk->uncompressed
+	) {
+		bad = 0;
+	}
+ ret:
+	xz_dec_end(s);
+	return bad;
+}
+
+static IF_DESKTOP(long long) int unpack_xz_blocks(transformer_state_t *xstate,
+		const uint8_t *header, struct xz_block *blocks, unsigned count,
+		unsigned jobs)
+{
+	struct xz_worker *workers = xzalloc(jobs * sizeof(workers[0]));
+	uint8_t *buf = xmalloc(2 * BUFSIZ);
+	unsigned next = 0, done = 0;
+	size_t mem = 0;
+	smallint serial = 0;
+	IF_DESKTOP(long long) int total = 0;
+
+	while (done < count) {
+		int r;
+
+		/* Start as many as fit in XZ_MAX_MEM, but at least one */
+		while (!serial && next < count && next - done < jobs
+		 && (next == done || mem + xz_block_mem(&blocks[next]) <= XZ_MAX_MEM)
+		) {
+			if (start_xz_worker(&workers[next % jobs], xstate->src_fd,
+					header, &blocks[next]) != 0
+			) {
+				serial = 1;
+				break;
+			}
+			mem += xz_block_mem(&blocks[next]);
+			next++;
+		}
+		r = 1;
+		if (done != next) {
+			r = finish_xz_worker(xstate, &workers[done % jobs],
+					&blocks[done], buf);
+			mem -= xz_block_mem(&blocks[done]);
+			if (r > 0) {
+				/* Short of memory or processes: don't make it
+				 * worse, decode the rest one by one right here */
+				serial = 1;
+				stop_xz_workers(workers, jobs, done + 1, next);
+				next = done + 1;
+			}
+		}
+		if (r > 0) {
+			r = unpack_xz_block(xstate, header, &blocks[done], buf);
+			if (done == next)
+				next++;
+		}
+		done++;
+		if (r != 0) {
+			bb_simple_error_msg("corrupted data");
+			total = -1;
+			/* Stop the others */
+			stop_xz_workers(workers, jobs, done, next);
+			break;
+		}
+		IF_DESKTOP(total += blocks[done - 1].uncompressed;)
+	}
+	/* Leave file position at the end of the stream, as if we read it */
+	if (total >= 0)
+		xlseek(xstate->src_fd, 0, SEEK_END);
+	free(buf);
+	free(workers);
+	return total;
+}
+#endif
+
+
 IF_DESKTOP(long long) int FAST_FUNC
 unpack_xz_stream(transformer_state_t *xstate)
 {
@@ -54,6 +420,30 @@ unpack_xz_stream(transformer_state_t *xstate)
 	if (!global_crc32_table)
 		global_crc32_new_table_le();
 
+#if ENABLE_FEATURE_XZ_PARALLEL
+	if (!xstate->mem_output_size_max) {
+		unsigned jobs = xz_jobs;
+		if (jobs > 1) {
+			uint8_t header[STREAM_HEADER_SIZE];
+			struct xz_block *blocks;
+			unsigned count;
+			off_t start = lseek(xstate->src_fd, 0, SEEK_CUR);
+
+			if (xstate->signature_skipped)
+				start -= HEADER_MAGIC_SIZE;
+			blocks = NULL;
+			if (start >= 0)
+				blocks = read_xz_index(xstate->src_fd, start, header, &count);
+			if (blocks) {
+				total = unpack_xz_blocks(xstate, header, blocks, count,
+						MIN(jobs, count));
+				free(blocks);
+				return total;
+			}
+		}
+	}
+#endif
+
 	memset(&iobuf, 0, sizeof(iobuf));
 	membuf = xmalloc(2 * BUFSIZ);
 	iobuf.in = membuf;
@@ -380,6 +380,8 @@ struct globals {
 #if ENABLE_PLATFORM_MINGW32
 	int a_count, A_count;
 # define HIDSYS (FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM)
+#else
+	smallint no_statx; /* kernel < 4.11, or statx filtered by seccomp */
 #endif
 } FIX_ALIASING;
 #define G (*(struct globals*)bb_common_bufsiz1)
@@ -800,6 +802,30 @@ static void display_files(struct dnode **dn, unsigned nfiles)
 
 /*** Dir scanning code ***/
 
+static void dnode_fill_stat(struct dnode *cur, const struct stat *statbuf)
+{
+	/* cur->dstat = *statbuf: */
+	cur->dn_mode   = statbuf->st_mode  ;
+#if ENABLE_PLATFORM_MINGW32
+	cur->dn_attr   = statbuf->st_attr  ;
+#endif
+	cur->dn_size   = statbuf->st_size  ;
+#if ENABLE_FEATURE_LS_TIMESTAMPS || ENABLE_FEATURE_LS_SORTFILES
+	cur->dn_time   = statbuf->st_mtime ;
+	if (option_mask32 & OPT_u)
+		cur->dn_time = statbuf->st_atime;
+	if (option_mask32 & OPT_c)
+		cur->dn_time = statbuf->st_ctime;
+#endif
+	cur->dn_ino    = statbuf->st_ino   ;
+	cur->dn_blocks = statbuf->st_blocks;
+	cur->dn_nlink  = statbuf->st_nlink ;
+	cur->dn_uid    = statbuf->st_uid   ;
+	cur->dn_gid    = statbuf->st_gid   ;
+	cur->dn_rdev_maj = major(statbuf->st_rdev);
+	cur->dn_rdev_min = minor(statbuf->st_rdev);
+}
+
 static struct dnode *my_stat(const char *fullname, const char *name, int force_follow)
 {
 	struct stat statbuf;
@@ -837,29 +863,172 @@ static struct dnode *my_stat(const char *fullname, const char *name, int force_f
 		cur->dn_mode_lstat = statbuf.st_mode;
 	}
 
-	/* cur->dstat = statbuf: */
-	cur->dn_mode   = statbuf.st_mode  ;
-#if ENABLE_PLATFORM_MINGW32
-	cur->dn_attr   = statbuf.st_attr  ;
-#endif
-	cur->dn_size   = statbuf.st_size  ;
-#if ENABLE_FEATURE_LS_TIMESTAMPS || ENABLE_FEATURE_LS_SORTFILES
-	cur->dn_time   = statbuf.st_mtime ;
-	if (option_mask32 & OPT_u)
-		cur->dn_time = statbuf.st_atime;
-	if (option_mask32 & OPT_c)
-		cur->dn_time = statbuf.st_ctime;
-#endif
-	cur->dn_ino    = statbuf.st_ino   ;
-	cur->dn_blocks = statbuf.st_blocks;
-	cur->dn_nlink  = statbuf.st_nlink ;
-	cur->dn_uid    = statbuf.st_uid   ;
-	cur->dn_gid    = statbuf.st_gid   ;
-	cur->dn_rdev_maj = major(statbuf.st_rdev);
-	cur->dn_rdev_min = minor(statbuf.st_rdev);
+	dnode_fill_stat(cur, &statbuf);
+	return cur;
+}
+
+#if !ENABLE_PLATFORM_MINGW32
+# include <sys/syscall.h>
+/* statx() field bits, also used (as "need to stat at all")
+ * if there is no statx() */
+# ifndef STATX_TYPE
+#  define STATX_TYPE   0x0001U
+#  define STATX_MODE   0x0002U
+#  define STATX_NLINK  0x0004U
+#  define STATX_UID    0x0008U
+#  define STATX_GID    0x0010U
+#  define STATX_ATIME  0x0020U
+#  define STATX_MTIME  0x0040U
+#  define STATX_CTIME  0x0080U
+#  define STATX_INO    0x0100U
+#  define STATX_SIZE   0x0200U
+#  define STATX_BLOCKS 0x0400U
+# endif
+
+# if defined(__NR_statx)
+#  ifndef AT_NO_AUTOMOUNT
+#   define AT_NO_AUTOMOUNT 0x800
+#  endif
+/* Kernel ABI of struct statx. We call the syscall directly:
+ * libc may predate statx() (glibc < 2.28, musl < 1.2.5) even when
+ * the kernel headers, and the kernel, have it */
+struct ls_statx_timestamp {
+	int64_t  tv_sec;
+	uint32_t tv_nsec;
+	int32_t  reserved;
+};
+struct ls_statx {
+	uint32_t stx_mask;
+	uint32_t stx_blksize;
+	uint64_t stx_attributes;
+	uint32_t stx_nlink;
+	uint32_t stx_uid;
+	uint32_t stx_gid;
+	uint16_t stx_mode;
+	uint16_t spare0;
+	uint64_t stx_ino;
+	uint64_t stx_size;
+	uint64_t stx_blocks;
+	uint64_t stx_attributes_mask;
+	struct ls_statx_timestamp stx_atime, stx_btime, stx_ctime, stx_mtime;
+	uint32_t stx_rdev_major;
+	uint32_t stx_rdev_minor;
+	uint32_t stx_dev_major;
+	uint32_t stx_dev_minor;
+	uint64_t spare2[14];
+};
+# endif
+
+/* What we need to know about directory entries for current options.
+ * Zero means the file type from readdir() is enough */
+static unsigned entry_stat_mask(void)
+{
+	unsigned opt = option_mask32;
+	unsigned mask = 0;
+	unsigned time_mask = (opt & OPT_u) ? STATX_ATIME
+			: (opt & OPT_c) ? STATX_CTIME : STATX_MTIME;
 
+	if (opt & OPT_l)
+		mask |= STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID
+			| STATX_SIZE | STATX_BLOCKS | time_mask;
+	if (opt & OPT_s)
+		mask |= STATX_BLOCKS;
+	if (opt & OPT_i)
+		mask |= STATX_INO;
+	if (opt & OPT_S)
+		mask |= STATX_SIZE;
+	if (opt & OPT_t)
+		mask |= time_mask;
+	/* -F shows executables, and colors also setuid files etc */
+	if ((opt & OPT_F) || G_show_color)
+		mask |= STATX_TYPE | STATX_MODE;
+	/* Types of symlink targets */
+	if (opt & OPT_L)
+		mask |= STATX_TYPE;
+	/* Whatever else we stat for, dn_mode must still get the file type */
+	if (mask)
+		mask |= STATX_TYPE;
+	return mask;
+}
+
+/* [l]stat a directory entry, asking only for the fields in mask:
+ * on network filesystems, fewer fields may need fewer round trips.
+ * Names are relative to the open directory, which saves
+ * the kernel looking up the whole path for every file */
+static int stat_entry(int dir_fd, const char *name, unsigned mask, struct stat *statbuf)
+{
+	int flags = (option_mask32 & OPT_L) ? 0 : AT_SYMLINK_NOFOLLOW;
+# if defined(__NR_statx)
+	if (!G.no_statx) {
+		struct ls_statx stx;
+
+		if (syscall(__NR_statx, dir_fd, name, flags | AT_NO_AUTOMOUNT, mask, &stx) == 0) {
+			statbuf->st_mode   = stx.stx_mode;
+			statbuf->st_size   = stx.stx_size;
+			statbuf->st_atime  = stx.stx_atime.tv_sec;
+			statbuf->st_mtime  = stx.stx_mtime.tv_sec;
+			statbuf->st_ctime  = stx.stx_ctime.tv_sec;
+			statbuf->st_ino    = stx.stx_ino;
+			statbuf->st_blocks = stx.stx_blocks;
+			statbuf->st_nlink  = stx.stx_nlink;
+			statbuf->st_uid    = stx.stx_uid;
+			statbuf->st_gid    = stx.stx_gid;
+			statbuf->st_rdev   = makedev(stx.stx_rdev_major, stx.stx_rdev_minor);
+			return 0;
+		}
+		/* Old kernel, or a seccomp filter (containers) rejecting
+		 * syscalls it does not know: use fstatat from now on */
+		if (errno != ENOSYS && errno != EPERM)
+			return -1;
+		G.no_statx = 1;
+	}
+# else
+	(void)mask;
+# endif
+	return fstatat(dir_fd, name, statbuf, flags);
+}
+
+/* my_stat() for a directory entry */
+static struct dnode *my_stat_entry(int dir_fd, const struct dirent *entry,
+		const char *fullname, unsigned mask)
+{
+	struct stat statbuf;
+	struct dnode *cur;
+
+	/* -R, -p, --group-directories-first need only file types */
+	if (!mask && entry->d_type == DT_UNKNOWN
+	 && (option_mask32 & (OPT_R|OPT_p|OPT_dirs_first))
+	) {
+		mask = STATX_TYPE;
+	}
+	if (!mask) {
+		cur = xzalloc(sizeof(*cur));
+		cur->fullname = fullname;
+		cur->name = bb_basename(fullname);
+		cur->dn_mode = DTTOIF(entry->d_type);
+		cur->dn_ino = entry->d_ino;
+		return cur;
+	}
+
+	if (stat_entry(dir_fd, entry->d_name, mask, &statbuf)) {
+		bb_simple_perror_msg(fullname);
+		G.exit_code = EXIT_FAILURE;
+		return NULL;
+	}
+	cur = xzalloc(sizeof(*cur));
+	cur->fullname = fullname;
+	cur->name = bb_basename(fullname);
+	/* Not if we have only the type bits */
+	if (mask & STATX_MODE) {
+		if (option_mask32 & OPT_L)
+			cur->dn_mode_stat = statbuf.st_mode;
+		else
+			cur->dn_mode_lstat = statbuf.st_mode;
+	}
+	dnode_fill_stat(cur, &statbuf);
 	return cur;
 }
+#endif
 
 static unsigned count_dirs(struct dnode **dn, int which)
 {
@@ -1040,6 +1209,8 @@ static struct dnode **scan_one_dir(const char *path, unsigned *nfiles_p)
 	unsigned i, nfiles;
 #if ENABLE_PLATFORM_MINGW32
 	struct stat statbuf;
+#else
+	unsigned mask = entry_stat_mask();
 #endif
 
 	*nfiles_p = 0;
@@ -1079,7 +1250,12 @@ static struct dnode **scan_one_dir(const char *path, unsigned *nfiles_p)
 			}
 		}
 #endif
-		cur = my_stat(fullname, bb_basename(fullname), 0);
+#if !ENABLE_PLATFORM_MINGW32
+		if (!(ENABLE_SELINUX && (option_mask32 & OPT_Z)))
+			cur = my_stat_entry(dirfd(dir), entry, fullname, mask);
+		else
+#endif
+			cur = my_stat(fullname, bb_basename(fullname), 0);
 #if !ENABLE_PLATFORM_MINGW32
 		if (!cur) {
 #else
@@ -52,6 +52,15 @@
 //config:	Enabling the -c options allows files to be checked
 //config:	against pre-calculated hash values.
 //config:	-s and -w are useful options when verifying checksums.
+//config:
+//config:config FEATURE_MD5_SHA1_SUM_PARALLEL
+//config:	bool "Hash several files at once (-j N)"
+//config:	default y
+//config:	depends on (MD5SUM || SHA1SUM || SHA256SUM || SHA384SUM || SHA512SUM || SHA3SUM) && PLATFORM_POSIX && !NOMMU
+//config:	help
+//config:	With -j N, files (or files listed for -c) are hashed by
+//config:	N child processes, which makes checking many files scale
+//config:	with the number of CPUs. Output is the same as without -j.
 
 //applet:IF_MD5SUM(APPLET_NOEXEC(md5sum, md5_sha1_sum, BB_DIR_USR_BIN, BB_SUID_DROP, md5sum))
 //applet:IF_SHA1SUM(APPLET_NOEXEC(sha1sum, md5_sha1_sum, BB_DIR_USR_BIN, BB_SUID_DROP, sha1sum))
@@ -68,7 +77,7 @@
 //kbuild:lib-$(CONFIG_SHA3SUM)   += md5_sha1_sum.o
 
 //usage:#define md5sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")IF_FEATURE_MD5_SHA1_SUM_PARALLEL("[-j N] ")"[FILE]..."
 //usage:#define md5sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " MD5 checksums"
 //usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
@@ -76,6 +85,9 @@
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
 //usage:	)
+//usage:	IF_FEATURE_MD5_SHA1_SUM_PARALLEL(
+//usage:     "\n	-j N	Hash files with N processes"
+//usage:	)
 //usage:
 //usage:#define md5sum_example_usage
 //usage:       "$ md5sum < busybox\n"
@@ -88,7 +100,7 @@
 //usage:       "^D\n"
 //usage:
 //usage:#define sha1sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")IF_FEATURE_MD5_SHA1_SUM_PARALLEL("[-j N] ")"[FILE]..."
 //usage:#define sha1sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " SHA1 checksums"
 //usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
@@ -96,9 +108,12 @@
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
 //usage:	)
+//usage:	IF_FEATURE_MD5_SHA1_SUM_PARALLEL(
+//usage:     "\n	-j N	Hash files with N processes"
+//usage:	)
 //usage:
 //usage:#define sha256sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")IF_FEATURE_MD5_SHA1_SUM_PARALLEL("[-j N] ")"[FILE]..."
 //usage:#define sha256sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " SHA256 checksums"
 //usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
@@ -106,9 +121,12 @@
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
 //usage:	)
+//usage:	IF_FEATURE_MD5_SHA1_SUM_PARALLEL(
+//usage:     "\n	-j N	Hash files with N processes"
+//usage:	)
 //usage:
 //usage:#define sha384sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")IF_FEATURE_MD5_SHA1_SUM_PARALLEL("[-j N] ")"[FILE]..."
 //usage:#define sha384sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " SHA384 checksums"
 //usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
@@ -116,9 +134,12 @@
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
 //usage:	)
+//usage:	IF_FEATURE_MD5_SHA1_SUM_PARALLEL(
+//usage:     "\n	-j N	Hash files with N processes"
+//usage:	)
 //usage:
 //usage:#define sha512sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")IF_FEATURE_MD5_SHA1_SUM_PARALLEL("[-j N] ")"[FILE]..."
 //usage:#define sha512sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " SHA512 checksums"
 //usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
@@ -126,9 +147,12 @@
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
 //usage:	)
+//usage:	IF_FEATURE_MD5_SHA1_SUM_PARALLEL(
+//usage:     "\n	-j N	Hash files with N processes"
+//usage:	)
 //usage:
 //usage:#define sha3sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[-a BITS] [FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")IF_FEATURE_MD5_SHA1_SUM_PARALLEL("[-j N] ")"[-a BITS] [FILE]..."
 //usage:#define sha3sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " SHA3 checksums"
 //usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
@@ -136,6 +160,9 @@
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
 //usage:	)
+//usage:	IF_FEATURE_MD5_SHA1_SUM_PARALLEL(
+//usage:     "\n	-j N	Hash files with N processes"
+//usage:	)
 //usage:     "\n	-a BITS	224 (default), 256, 384, 512"
 
 //FIXME: GNU coreutils 8.25 has no -s option, it has only these two long opts:
@@ -161,6 +188,21 @@ enum {
 #define FLAG_WARN    4
 #define FLAG_BINARY  8
 
+#if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+# define OPT_JOBS "j:+"
+#else
+# define OPT_JOBS ""
+#endif
+
+/* sha1sum/sha256sum hash several files at once, see struct hash_mb */
+#if ENABLE_SHA_MULTIBUFFER && (ENABLE_SHA1SUM || ENABLE_SHA256SUM)
+# define HASH_MB 1
+#else
+# define HASH_MB 0
+#endif
+/* Hashing may need to know all files in advance */
+#define HASH_LIST (ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL || HASH_MB)
+
 /* This might be useful elsewhere */
 static unsigned char *hash_bin_to_hex(unsigned char *hash_value,
 				unsigned hash_length)
@@ -171,7 +213,9 @@ static unsigned char *hash_bin_to_hex(unsigned char *hash_value,
 	return (unsigned char *)hex_value;
 }
 
-#define BUFSZ (CONFIG_FEATURE_COPYBUF_KB < 4 ? 4096 : CONFIG_FEATURE_COPYBUF_KB * 1024)
+/* Hashing is fast enough for read() syscall overhead to show
+ * with small reads, use at least 64k */
+#define BUFSZ (CONFIG_FEATURE_COPYBUF_KB < 64 ? 64 * 1024 : CONFIG_FEATURE_COPYBUF_KB * 1024)
 
 #if !ENABLE_SHA3SUM
 # define hash_file(b,f,w) hash_file(b,f)
@@ -196,6 +240,10 @@ static uint8_t *hash_file(unsigned char *in_buf, const char *filename, unsigned
 	if (src_fd < 0) {
 		return NULL;
 	}
+#if defined(POSIX_FADV_SEQUENTIAL)
+	/* Let the kernel read ahead more aggressively */
+	posix_fadvise(src_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
 
 	hash_algo = applet_name[3];
 
@@ -273,6 +321,304 @@ static uint8_t *hash_file(unsigned char *in_buf, const char *filename, unsigned
 	return hash_value;
 }
 
+#if HASH_LIST
+/* Several children can't share stdin, and lanes can't either */
+static int several_files(char **files, unsigned nfiles)
+{
+	if (nfiles < 2)
+		return 0;
+	while (nfiles--)
+		if (LONE_DASH(files[nfiles]))
+			return 0;
+	return 1;
+}
+#endif
+
+#if HASH_MB
+/* sha1sum/sha256sum of several files: SHA_MB_LANES of them are read
+ * a chunk at a time and hashed together by sha*_hash_mb().
+ * A lane which is done with its file takes the next one. Hashes
+ * which are ready before their turn to be printed wait in res[],
+ * and so do errors: they are shown in the order of files[]. */
+#define MB_CHUNK (BUFSZ / SHA_MB_LANES)
+
+struct mb_result {
+	uint8_t *hash;       /* NULL if the file can't be read: */
+	const char *err_fmt; /* why */
+	int err;             /* errno */
+};
+
+struct hash_mb {
+	char **files;
+	unsigned nfiles;
+	unsigned next_open; /* first file not given to a lane yet */
+	unsigned next;      /* whose result comes next */
+	struct mb_result *res;
+	int fd[SHA_MB_LANES]; /* -1: lane is idle */
+	unsigned idx[SHA_MB_LANES];
+	sha256_ctx_t ctx[SHA_MB_LANES];
+};
+
+static int is_sha1sum(void)
+{
+	return ENABLE_SHA1SUM && applet_name[3] == HASH_SHA1;
+}
+
+/* Only if lanes are really hashed at once: else reading files
+ * a small chunk at a time, and -c reading the list first, is a loss */
+static int mb_usable(void)
+{
+	if (is_sha1sum())
+		return sha1_hash_mb_usable();
+	return ENABLE_SHA256SUM && applet_name[3] == HASH_SHA256
+		&& sha256_hash_mb_usable();
+}
+
+static int want_mb(char **files, unsigned nfiles)
+{
+	return mb_usable() && several_files(files, nfiles);
+}
+
+static void start_hash_mb(struct hash_mb *mb, char **files, unsigned nfiles)
+{
+	unsigned i;
+
+	mb->files = files;
+	mb->nfiles = nfiles;
+	mb->next_open = 0;
+	mb->next = 0;
+	mb->res = xzalloc(nfiles * sizeof(mb->res[0]));
+	for (i = 0; i < SHA_MB_LANES; i++)
+		mb->fd[i] = -1;
+}
+
+static int mb_pending(struct hash_mb *mb, unsigned idx)
+{
+	unsigned i;
+
+	if (idx >= mb->next_open)
+		return 1;
+	for (i = 0; i < SHA_MB_LANES; i++)
+		if (mb->fd[i] >= 0 && mb->idx[i] == idx)
+			return 1;
+	return 0;
+}
+
+/* Hash of the next file, NULL if it can't be read */
+static uint8_t *next_mb_hash(struct hash_mb *mb, unsigned char *in_buf)
+{
+	struct mb_result *r;
+
+	while (mb_pending(mb, mb->next)) {
+		sha256_ctx_t *ctx[SHA_MB_LANES];
+		const void *buf[SHA_MB_LANES];
+		size_t len[SHA_MB_LANES];
+		unsigned i, n = 0;
+
+		for (i = 0; i < SHA_MB_LANES; i++) {
+			unsigned char *lane_buf = in_buf + i * MB_CHUNK;
+
+			for (;;) {
+				int count;
+
+				if (mb->fd[i] < 0) {
+					/* Give the idle lane a new file */
+					if (mb->next_open == mb->nfiles)
+						break;
+					mb->idx[i] = mb->next_open++;
+					mb->fd[i] = open(mb->files[mb->idx[i]], O_RDONLY);
+					if (mb->fd[i] < 0) {
+						r = &mb->res[mb->idx[i]];
+						r->err_fmt = "can't open '%s'";
+						r->err = errno;
+						continue;
+					}
+# if defined(POSIX_FADV_SEQUENTIAL)
+					posix_fadvise(mb->fd[i], 0, 0, POSIX_FADV_SEQUENTIAL);
+# endif
+					if (is_sha1sum())
+						sha1_begin(&mb->ctx[i]);
+					else
+						sha256_begin(&mb->ctx[i]);
+				}
+				count = safe_read(mb->fd[i], lane_buf, MB_CHUNK);
+				if (count > 0) {
+					ctx[n] = &mb->ctx[i];
+					buf[n] = lane_buf;
+					len[n] = count;
+					n++;
+					break;
+				}
+				r = &mb->res[mb->idx[i]];
+				if (count < 0) {
+					r->err_fmt = "can't read '%s'";
+					r->err = errno;
+				} else /* count == 0 */ {
+					/* sha256_end is sha1_end */
+					unsigned hash_len = sha1_end(&mb->ctx[i], lane_buf);
+					r->hash = hash_bin_to_hex(lane_buf, hash_len);
+				}
+				close(mb->fd[i]);
+				mb->fd[i] = -1;
+			}
+		}
+		if (is_sha1sum())
+			sha1_hash_mb(ctx, buf, len, n);
+		else
+			sha256_hash_mb(ctx, buf, len, n);
+	}
+	r = &mb->res[mb->next];
+	if (r->err_fmt) {
+		errno = r->err;
+		bb_perror_msg(r->err_fmt, mb->files[mb->next]);
+	}
+	mb->next++;
+	return r->hash;
+}
+
+static void finish_hash_mb(struct hash_mb *mb)
+{
+	free(mb->res);
+	mb->nfiles = 0;
+}
+#else
+# define mb_usable() 0
+#endif
+
+#if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+/* Child k of N hashes files k, k+N, k+2N... and writes a line with
+ * the hash (an empty one if the file can't be read) for each of them
+ * to its pipe. Its error messages go to the pipe too. The parent reads
+ * the results round-robin, that is, in the order of files[], and shows
+ * the messages as they come, also in that order. */
+struct hash_jobs {
+	unsigned n;
+	unsigned next;  /* whose result comes next */
+	pid_t *pid;
+	FILE **fp;
+};
+
+# if !ENABLE_SHA3SUM
+#  define start_hash_jobs(j,f,n,b,w) start_hash_jobs(j,f,n,b)
+# endif
+static void start_hash_jobs(struct hash_jobs *jobs,
+		char **files, unsigned nfiles,
+		unsigned char *in_buf, unsigned sha3_width)
+{
+	unsigned k;
+
+	if (jobs->n > nfiles)
+		jobs->n = nfiles;
+	jobs->next = 0;
+	jobs->pid = xmalloc(jobs->n * sizeof(jobs->pid[0]));
+	jobs->fp = xmalloc(jobs->n * sizeof(jobs->fp[0]));
+
+	/* Children must not write out our buffered data */
+	fflush_all();
+	for (k = 0; k < jobs->n; k++) {
+		struct fd_pair pipe;
+
+		xpiped_pair(pipe);
+		jobs->pid[k] = xfork();
+		if (jobs->pid[k] == 0) {
+			unsigned i, m;
+# if HASH_MB
+			struct hash_mb mb;
+# endif
+
+			/* Other children's pipes are not ours */
+			for (i = 0; i < k; i++)
+				fclose(jobs->fp[i]);
+			close(pipe.rd);
+			xmove_fd(pipe.wr, STDOUT_FILENO);
+			xdup2(STDOUT_FILENO, STDERR_FILENO);
+			/* Our files are k, k+N...: move them to the start */
+			m = 0;
+			for (i = k; i < nfiles; i += jobs->n)
+				files[m++] = files[i];
+# if HASH_MB
+			mb.nfiles = 0;
+			if (want_mb(files, m))
+				start_hash_mb(&mb, files, m);
+# endif
+			for (i = 0; i < m; i++) {
+				uint8_t *hash_value;
+# if HASH_MB
+				if (mb.nfiles)
+					hash_value = next_mb_hash(&mb, in_buf);
+				else
+# endif
+					hash_value = hash_file(in_buf, files[i], sha3_width);
+				printf("%s\n", hash_value ? (char*)hash_value : "");
+				free(hash_value);
+				/* Don't make the parent wait for a full buffer */
+				fflush_all();
+			}
+			_exit(EXIT_SUCCESS);
+		}
+		close(pipe.wr);
+		jobs->fp[k] = xfdopen_for_read(pipe.rd);
+	}
+}
+
+/* Hash of the next file, NULL if it can't be read */
+static uint8_t *next_job_hash(struct hash_jobs *jobs)
+{
+	char *hash_value;
+
+	/* Lines other than hex digits are the child's messages */
+	while ((hash_value = xmalloc_fgetline(jobs->fp[jobs->next])) != NULL
+	 && hash_value[strspn(hash_value, "0123456789abcdef")] != '\0'
+	) {
+		fflush_all();
+		fprintf(stderr, "%s\n", hash_value);
+		free(hash_value);
+	}
+	if (++jobs->next == jobs->n)
+		jobs->next = 0;
+	if (hash_value && !hash_value[0]) {
+		free(hash_value);
+		hash_value = NULL;
+	}
+	return (uint8_t*)hash_value;
+}
+
+static void finish_hash_jobs(struct hash_jobs *jobs)
+{
+	while (jobs->n) {
+		jobs->n--;
+		fclose(jobs->fp[jobs->n]);
+		safe_waitpid(jobs->pid[jobs->n], NULL, 0);
+	}
+	free(jobs->fp);
+	free(jobs->pid);
+}
+
+/* -j N is pointless for one file */
+static int want_jobs(unsigned jobs, char **files, unsigned nfiles)
+{
+	return jobs >= 2 && several_files(files, nfiles);
+}
+#endif
+
+/* "HASH  FILENAME" line of a -c list: pointer to FILENAME,
+ * NULL if the line has no file name */
+static char *check_line_filename(char *line)
+{
+	char *filename_ptr = strchr(line, ' ');
+
+	if (filename_ptr) {
+		filename_ptr++;
+		/* coreutils 9.1 allows "HASH FILENAME" format,
+		 * with only one space. Skip the 'correct'
+		 * "  " or " *" delimiter if it is there:
+		 */
+		if (*filename_ptr == ' ' || *filename_ptr == '*')
+			filename_ptr++;
+	}
+	return filename_ptr;
+}
+
 int md5_sha1_sum_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 {
@@ -281,6 +627,16 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 	unsigned flags;
 #if ENABLE_SHA3SUM
 	unsigned sha3_width = 224;
+#endif
+#if HASH_MB
+	struct hash_mb mb;
+#endif
+#if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+	unsigned njobs = 1;
+	struct hash_jobs jobs;
+# define GETOPT_JOBS &njobs,
+#else
+# define GETOPT_JOBS
 #endif
 	const char *fmt = "%s  %s\n";
 
@@ -291,20 +647,21 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 		/* -s and -w require -c */
 #if ENABLE_SHA3SUM
 		if (applet_name[3] == HASH_SHA3 && (!ENABLE_SHA384SUM || applet_name[4] != '8'))
-			flags = getopt32(argv, "^" "scwbta:+" "\0" "t-b:s?c:w?c", &sha3_width);
+			flags = getopt32(argv, "^" "scwbt" OPT_JOBS "a:+" "\0" "t-b:s?c:w?c", GETOPT_JOBS &sha3_width);
 		else
 #endif
-			flags = getopt32(argv, "^" "scwbt" "\0" "t-b:s?c:w?c");
+			flags = getopt32(argv, "^" "scwbt" OPT_JOBS "\0" "t-b:s?c:w?c" IF_FEATURE_MD5_SHA1_SUM_PARALLEL(, &njobs));
 		if (flags & FLAG_BINARY)
 			fmt = "%s *%s\n";
 	} else {
 #if ENABLE_SHA3SUM
 		if (applet_name[3] == HASH_SHA3 && (!ENABLE_SHA384SUM || applet_name[4] != '8'))
-			getopt32(argv, "a:+", &sha3_width);
+			getopt32(argv, OPT_JOBS "a:+", GETOPT_JOBS &sha3_width);
 		else
 #endif
-			getopt32(argv, "");
+			getopt32(argv, OPT_JOBS IF_FEATURE_MD5_SHA1_SUM_PARALLEL(, &njobs));
 	}
+#undef GETOPT_JOBS
 	argv += optind;
 	//argc -= optind;
 	if (!*argv)
@@ -316,21 +673,77 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 	 */
 	in_buf = xmalloc(BUFSZ);
 
+#if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+	jobs.n = 0;
+	if (!(ENABLE_FEATURE_MD5_SHA1_SUM_CHECK && (flags & FLAG_CHECK))
+	 && want_jobs(njobs, argv, string_array_len(argv))) {
+		jobs.n = njobs;
+		start_hash_jobs(&jobs, argv, string_array_len(argv), in_buf, sha3_width);
+	}
+#endif
+#if HASH_MB
+	mb.nfiles = 0;
+	if (!(ENABLE_FEATURE_MD5_SHA1_SUM_CHECK && (flags & FLAG_CHECK))
+	 IF_FEATURE_MD5_SHA1_SUM_PARALLEL(&& !jobs.n)
+	 && want_mb(argv, string_array_len(argv))) {
+		start_hash_mb(&mb, argv, string_array_len(argv));
+	}
+#endif
 	do {
 		if (ENABLE_FEATURE_MD5_SHA1_SUM_CHECK && (flags & FLAG_CHECK)) {
 			FILE *pre_computed_stream;
 			char *line;
 			int count_total = 0;
 			int count_failed = 0;
+#if HASH_LIST
+			char **lines = NULL;
+			unsigned nlines = 0;
+#endif
 
 			pre_computed_stream = xfopen_stdin(*argv);
 
+#if HASH_LIST
+			if (IF_FEATURE_MD5_SHA1_SUM_PARALLEL(njobs > 1 ||) mb_usable()) {
+				/* Read the whole list to give its files to children or lanes */
+				char **files = NULL;
+				unsigned nfiles = 0;
+
+				while ((line = xmalloc_fgetline(pre_computed_stream)) != NULL) {
+					char *filename_ptr = check_line_filename(line);
+					lines = xrealloc_vector(lines, 6, nlines);
+					lines[nlines++] = line;
+					if (filename_ptr) {
+						files = xrealloc_vector(files, 6, nfiles);
+						files[nfiles++] = filename_ptr;
+					}
+				}
+				if (!lines) /* nothing to check */
+					lines = xzalloc(sizeof(lines[0]));
+# if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+				jobs.n = 0;
+				if (want_jobs(njobs, files, nfiles)) {
+					jobs.n = njobs;
+					start_hash_jobs(&jobs, files, nfiles, in_buf, sha3_width);
+				}
+# endif
+# if HASH_MB
+				if (IF_FEATURE_MD5_SHA1_SUM_PARALLEL(!jobs.n &&) want_mb(files, nfiles)) {
+					start_hash_mb(&mb, files, nfiles);
+					files = NULL; /* lanes need it, freed below */
+				}
+# endif
+				free(files);
+				nlines = 0;
+			}
+			while ((line = lines ? lines[nlines++] : xmalloc_fgetline(pre_computed_stream)) != NULL) {
+#else
 			while ((line = xmalloc_fgetline(pre_computed_stream)) != NULL) {
+#endif
 				uint8_t *hash_value;
 				char *filename_ptr;
 
 				count_total++;
-				filename_ptr = strchr(line, ' ');
+				filename_ptr = check_line_filename(line);
 				if (!filename_ptr) {
 					if (flags & FLAG_WARN) {
 						bb_simple_error_msg("invalid format");
@@ -340,15 +753,19 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 					free(line);
 					continue;
 				}
-				*filename_ptr++ = '\0';
-				/* coreutils 9.1 allows "HASH FILENAME" format,
-				 * with only one space. Skip the 'correct'
-				 * "  " or " *" delimiter if it is there:
-				 */
-				if (*filename_ptr == ' ' || *filename_ptr == '*')
-					filename_ptr++;
+				*strchr(line, ' ') = '\0';
 
-				hash_value = hash_file(in_buf, filename_ptr, sha3_width);
+#if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+				if (jobs.n)
+					hash_value = next_job_hash(&jobs);
+				else
+#endif
+#if HASH_MB
+				if (mb.nfiles)
+					hash_value = next_mb_hash(&mb, in_buf);
+				else
+#endif
+					hash_value = hash_file(in_buf, filename_ptr, sha3_width);
 
 				if (hash_value && (strcasecmp((char*)hash_value, line) == 0)) {
 					if (!(flags & FLAG_SILENT))
@@ -363,6 +780,19 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 				free(hash_value);
 				free(line);
 			}
+#if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+			if (jobs.n)
+				finish_hash_jobs(&jobs);
+#endif
+#if HASH_MB
+			if (mb.nfiles) {
+				free(mb.files);
+				finish_hash_mb(&mb);
+			}
+#endif
+#if HASH_LIST
+			free(lines);
+#endif
 			if (count_failed && !(flags & FLAG_SILENT)) {
 				bb_error_msg("WARNING: %d of %d computed checksums did NOT match",
 						count_failed, count_total);
@@ -377,7 +807,18 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 			}
 			fclose_if_not_stdin(pre_computed_stream);
 		} else {
-			uint8_t *hash_value = hash_file(in_buf, *argv, sha3_width);
+			uint8_t *hash_value;
+#if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+			if (jobs.n)
+				hash_value = next_job_hash(&jobs);
+			else
+#endif
+#if HASH_MB
+			if (mb.nfiles)
+				hash_value = next_mb_hash(&mb, in_buf);
+			else
+#endif
+				hash_value = hash_file(in_buf, *argv, sha3_width);
 			if (hash_value == NULL) {
 				return_value = EXIT_FAILURE;
 			} else {
@@ -386,6 +827,14 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 			}
 		}
 	} while (*++argv);
+#if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+	if (jobs.n)
+		finish_hash_jobs(&jobs);
+#endif
+#if HASH_MB
+	if (mb.nfiles)
+		finish_hash_mb(&mb);
+#endif
 
 	return return_value;
 }
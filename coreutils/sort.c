@@ -36,6 +36,23 @@
 //config:	help
 //config:	Attempt to use less memory (by storing only one copy
 //config:	of duplicated lines, and such). Useful if you work on huge files.
+//config:
+//config:config FEATURE_SORT_EXTERNAL
+//config:	bool "Sort input bigger than memory (-S SIZE, -T DIR)"
+//config:	default y
+//config:	depends on SORT
+//config:	help
+//config:	With -S SIZE, sort at most SIZE bytes of input in memory
+//config:	at a time, save the sorted runs to temporary files in -T DIR
+//config:	(default $TMPDIR or /tmp) and merge them.
+//config:
+//config:config FEATURE_SORT_PARALLEL
+//config:	bool "Sort using several processes (--parallel=N)"
+//config:	default y
+//config:	depends on FEATURE_SORT_EXTERNAL && LONG_OPTS && PLATFORM_POSIX && !NOMMU
+//config:	help
+//config:	With --parallel=N, split the lines into N parts which are
+//config:	sorted by child processes, and merge the results.
 
 //applet:IF_SORT(APPLET_NOEXEC(sort, sort, BB_DIR_USR_BIN, BB_SUID_DROP, sort))
 
@@ -49,6 +66,7 @@
 //usage:	IF_PLATFORM_MINGW32(
 //usage:	IF_FEATURE_SORT_BIG("ghMVcszbdfiokt] [-o FILE] [-k START[.OFS][OPTS][,END[.OFS][OPTS]] [-t CHAR")
 //usage:	)
+//usage:	IF_FEATURE_SORT_EXTERNAL("] [-S SIZE] [-T DIR")
 //usage:       "] [FILE]..."
 //usage:#define sort_full_usage "\n\n"
 //usage:       "Sort lines of text\n"
@@ -74,6 +92,14 @@
 //usage:     "\n	-s	Stable (don't sort ties alphabetically)"
 //usage:     "\n	-u	Suppress duplicate lines"
 //usage:     "\n	-z	NUL terminated input and output"
+//usage:	IF_FEATURE_SORT_EXTERNAL(
+//usage:     "\n	-S SIZE	Sort at most SIZE (b,k,M,G,%) bytes in memory,"
+//usage:     "\n		merge sorted runs kept in temporary files"
+//usage:     "\n	-T DIR	Directory for temporary files"
+//usage:	)
+//usage:	IF_FEATURE_SORT_PARALLEL(
+//usage:     "\n	--parallel=N	Sort using N processes"
+//usage:	)
 ///////:     "\n	-m	Ignored for GNU compatibility"
 ///////:     "\n	-S BUFSZ Ignored for GNU compatibility"
 ///////:     "\n	-T TMPDIR Ignored for GNU compatibility"
@@ -115,8 +141,8 @@ enum {
 	FLAG_f  = 1 << 12,      /* Force uppercase */
 	FLAG_i  = 1 << 13,      /* Ignore !isprint() */
 	FLAG_m  = 1 << 14,      /* ignored: merge already sorted files; do not sort */
-	FLAG_S  = 1 << 15,      /* ignored: -S, --buffer-size=SIZE */
-	FLAG_T  = 1 << 16,      /* ignored: -T, --temporary-directory=DIR */
+	FLAG_S  = 1 << 15,      /* -S, --buffer-size=SIZE */
+	FLAG_T  = 1 << 16,      /* -T, --temporary-directory=DIR */
 	FLAG_o  = 1 << 17,
 	FLAG_k  = 1 << 18,
 	FLAG_t  = 1 << 19,
@@ -126,7 +152,13 @@ enum {
 
 static const char sort_opt_str[] ALIGN1 = "^"
 			"nghMVucszbrdfimS:T:o:k:*t:"
+			IF_FEATURE_SORT_PARALLEL("\xff:+")
 			"\0" "o--o:t--t"/*-t, -o: at most one of each*/;
+#if ENABLE_FEATURE_SORT_PARALLEL
+static const char sort_longopts[] ALIGN1 =
+	"parallel\0" Required_argument "\xff"
+	;
+#endif
 /*
  * OPT_STR must not be string literal, needs to have stable address:
  * code uses "strchr(OPT_STR,c) - OPT_STR" idiom.
@@ -446,13 +478,350 @@ static unsigned str2u(char **str)
 }
 #endif
 
+/* Sort lines[], handle -s and -u. Returns new linecount */
+static int sort_lines(char **lines, int linecount)
+{
+	unsigned flags = option_mask32;
+	int i;
+
+	/* For stable sort, store original line position beyond terminating NUL */
+	if (flags & FLAG_s) {
+		for (i = 0; i < linecount; i++) {
+			uint32_t *p32;
+			char *line;
+			unsigned len;
+
+			line = lines[i];
+			len = (strlen(line) + 4) & (~3u);
+			lines[i] = line = xrealloc(line, len + 4);
+			p32 = (void*)(line + len);
+			*p32 = i;
+		}
+		/*option_mask32 |= FLAG_no_tie_break;*/
+		/* ^^^redundant: if FLAG_s, compare_keys() does no tie break */
+	}
+
+	/* Perform the actual sort */
+	qsort(lines, linecount, sizeof(lines[0]), compare_keys);
+
+	/* Handle -u */
+	if (flags & FLAG_u) {
+		int j = 0;
+		/* coreutils 6.3 drop lines for which only key is the same:
+		 * - disabling last-resort compare, or else compare_keys()
+		 * will be the same only for completely identical lines
+		 * - disabling -s (same reasons)
+		 */
+		option_mask32 = (flags | FLAG_no_tie_break) & (~FLAG_s);
+		for (i = 1; i < linecount; i++) {
+			if (compare_keys(&lines[j], &lines[i]) == 0)
+				free(lines[i]);
+			else
+				lines[++j] = lines[i];
+		}
+		if (linecount)
+			linecount = j+1;
+		option_mask32 = flags;
+	}
+	return linecount;
+}
+
+static void write_lines(FILE *fp, char **lines, int linecount)
+{
+	int ch = (option_mask32 & FLAG_z) ? '\0' : '\n';
+	int i;
+
+	for (i = 0; i < linecount; i++)
+		fprintf(fp, "%s%c", lines[i], ch);
+}
+
+#if ENABLE_FEATURE_SORT_EXTERNAL
+/* With -S, input is sorted in chunks which fit in memory. Each sorted
+ * chunk ("run") is saved in a temporary file. SORT_MERGE runs of the
+ * same level are merged into one run of the next level, so no line is
+ * copied more than log(N)/log(SORT_MERGE) times, and the remaining runs
+ * are merged to the output.
+ */
+#define SORT_MERGE 16
+
+static struct sort_run {
+	FILE *fp;
+	char *line;	/* next line from fp */
+	unsigned level;	/* 0: sorted chunk of input, N: merge of level N-1 runs */
+#if ENABLE_PLATFORM_MINGW32
+	char *name;	/* open files can't be deleted, remove after fclose */
+#endif
+} *runs;
+static unsigned nruns;
+static const char *tmpdir;
+
+static void open_run(struct sort_run *run)
+{
+	char *name = concat_path_file(tmpdir, "sortXXXXXX");
+	int fd = xmkstemp(name);
+
+#if !ENABLE_PLATFORM_MINGW32
+	unlink(name);
+	free(name);
+#else
+	run->name = name;
+#endif
+	run->fp = fdopen(fd, "w+");
+	if (!run->fp)
+		bb_die_memory_exhausted();
+	run->level = 0;
+}
+
+static void close_run(struct sort_run *run)
+{
+	fclose(run->fp);
+#if ENABLE_PLATFORM_MINGW32
+	unlink(run->name);
+	free(run->name);
+#endif
+}
+
+/* In merge heap, is run a before run b? */
+static int run_before(struct sort_run *r, unsigned a, unsigned b)
+{
+	int retval = compare_keys(&r[a].line, &r[b].line);
+	/* Of equal lines, take the one from the earlier run first:
+	 * this keeps -s stable and -u keeps the same line as without -S */
+	return retval ? (retval < 0) : (a < b);
+}
+
+static void sift_down(struct sort_run *r, unsigned *heap, unsigned n, unsigned i)
+{
+	for (;;) {
+		unsigned c = 2 * i + 1;
+		unsigned t;
+
+		if (c >= n)
+			break;
+		if (c + 1 < n && run_before(r, heap[c + 1], heap[c]))
+			c++;
+		if (!run_before(r, heap[c], heap[i]))
+			break;
+		t = heap[i];
+		heap[i] = heap[c];
+		heap[c] = t;
+		i = c;
+	}
+}
+
+/* Merge n runs into out, close them */
+static void merge_runs(struct sort_run *r, unsigned n, FILE *out)
+{
+	unsigned flags = option_mask32;
+	/* Lines in runs don't have -s line numbers,
+	 * runs are already sorted by them */
+	unsigned flags_u = (flags | FLAG_no_tie_break) & (~FLAG_s);
+	unsigned flags_merge = (flags & FLAG_s) ? flags_u : flags;
+	int ch = (flags & FLAG_z) ? '\0' : '\n';
+	unsigned *heap = xmalloc(n * sizeof(heap[0]));
+	unsigned i, hn;
+	char *prev = NULL;
+
+	hn = 0;
+	for (i = 0; i < n; i++) {
+		r[i].line = GET_LINE(r[i].fp);
+		if (r[i].line)
+			heap[hn++] = i;
+		else
+			close_run(&r[i]);
+	}
+	option_mask32 = flags_merge;
+	for (i = hn / 2; i-- != 0;)
+		sift_down(r, heap, hn, i);
+
+	while (hn) {
+		struct sort_run *top = &r[heap[0]];
+
+		if (flags & FLAG_u) {
+			option_mask32 = flags_u;
+			if (prev && compare_keys(&prev, &top->line) == 0) {
+				free(top->line);
+			} else {
+				fprintf(out, "%s%c", top->line, ch);
+				free(prev);
+				prev = top->line;
+			}
+			option_mask32 = flags_merge;
+		} else {
+			fprintf(out, "%s%c", top->line, ch);
+			free(top->line);
+		}
+		top->line = GET_LINE(top->fp);
+		if (!top->line) {
+			close_run(top);
+			heap[0] = heap[--hn];
+		}
+		sift_down(r, heap, hn, 0);
+	}
+	free(prev);
+	free(heap);
+	option_mask32 = flags;
+}
+
+/* run is written: add it to runs[], merge runs if there are enough */
+static void add_run(struct sort_run run)
+{
+	for (;;) {
+		if (fflush(run.fp) != 0 || ferror(run.fp))
+			bb_simple_perror_msg_and_die(tmpdir);
+		rewind(run.fp);
+		runs = xrealloc_vector(runs, 4, nruns);
+		runs[nruns++] = run;
+		if (nruns < SORT_MERGE || runs[nruns - SORT_MERGE].level != run.level)
+			break;
+		nruns -= SORT_MERGE;
+		open_run(&run);
+		merge_runs(runs + nruns, SORT_MERGE, run.fp);
+		run.level = runs[nruns].level + 1;
+	}
+}
+
+#if ENABLE_FEATURE_SORT_PARALLEL
+/* Don't bother forking for fewer lines per process */
+#define SORT_MIN_PER_JOB 4096
+
+static unsigned sort_jobs;
+
+/* Sort lines[] in jobs child processes, merge their output to out */
+static void sort_parallel(FILE *out, char **lines, int linecount, unsigned jobs)
+{
+	struct sort_run *w = xmalloc(jobs * sizeof(w[0]));
+	pid_t *pids = xmalloc(jobs * sizeof(pids[0]));
+	unsigned j;
+
+	/* Children must not write out our buffered data */
+	fflush_all();
+	for (j = 0; j < jobs; j++) {
+		/* Contiguous parts, in order: merge_runs() takes equal lines
+		 * from earlier runs first, which keeps -s stable */
+		int first = (long long)linecount * j / jobs;
+		int last = (long long)linecount * (j + 1) / jobs;
+		struct fd_pair pipe;
+
+		xpiped_pair(pipe);
+		pids[j] = xfork();
+		if (pids[j] == 0) {
+			FILE *fp;
+			int n;
+
+			close(pipe.rd);
+			fp = xfdopen_for_write(pipe.wr);
+			n = sort_lines(lines + first, last - first);
+			write_lines(fp, lines + first, n);
+			_exit(fflush(fp) != 0);
+		}
+		close(pipe.wr);
+		w[j].fp = xfdopen_for_read(pipe.rd);
+		w[j].level = 0;
+	}
+	merge_runs(w, jobs, out);
+	for (j = 0; j < jobs; j++) {
+		int status;
+		if (safe_waitpid(pids[j], &status, 0) < 0 || status != 0)
+			bb_simple_error_msg_and_die("child process failed");
+	}
+	free(pids);
+	free(w);
+}
+#endif
+
+/* Sort lines[] and write them to out.
+ * Returns number of lines left in lines[] (-u may free some) */
+static int sort_and_write(FILE *out, char **lines, int linecount)
+{
+#if ENABLE_FEATURE_SORT_PARALLEL
+	unsigned jobs = MIN(sort_jobs, linecount / SORT_MIN_PER_JOB);
+	if (jobs > 1) {
+		sort_parallel(out, lines, linecount, jobs);
+		return linecount;
+	}
+#endif
+	linecount = sort_lines(lines, linecount);
+	write_lines(out, lines, linecount);
+	return linecount;
+}
+
+/* Parse -S SIZE like coreutils: a plain number is in kilobytes,
+ * "b" means bytes, K/M/G/T/P/E are powers of 1024 and "N%" is
+ * that much of physical memory. Returns 0 (no limit) for sizes
+ * we can't parse: -S used to be ignored, don't break scripts */
+static size_t parse_sort_size(const char *str)
+{
+	static const char suffixes[] ALIGN1 = "bKMGTPE";
+	unsigned long long sz;
+	const char *p;
+	char *end;
+
+	if (!isdigit(*str))
+		return 0;
+	errno = 0;
+	sz = strtoull(str, &end, 10);
+	if (errno)
+		return (size_t)-1L;
+	if (end[0] == '%' && end[1] == '\0') {
+# ifdef _SC_PHYS_PAGES
+		long pages = sysconf(_SC_PHYS_PAGES);
+		long pagesize = sysconf(_SC_PAGESIZE);
+		if (pages <= 0 || pagesize <= 0 || sz > 100)
+			return 0;
+		sz = (unsigned long long)pages * pagesize / 100 * sz;
+		return MIN(sz, (size_t)-1L);
+# else
+		return 0;
+# endif
+	}
+	p = suffixes + 1; /* K */
+	if (end[0] != '\0') {
+		if (end[1] != '\0')
+			return 0;
+		p = strchr(suffixes, (end[0] == 'k') ? 'K' : end[0]);
+		if (!p)
+			return 0;
+	}
+	for (; p != suffixes; p--) {
+		if (sz > ((size_t)-1L) / 1024)
+			return (size_t)-1L;
+		sz *= 1024;
+	}
+	return MIN(sz, (size_t)-1L);
+}
+
+/* Sort lines[] and save them as a level 0 run */
+static void spill_lines(char **lines, int linecount)
+{
+	struct sort_run run;
+	int i;
+
+	open_run(&run);
+	linecount = sort_and_write(run.fp, lines, linecount);
+	for (i = 0; i < linecount; i++)
+		free(lines[i]);
+	add_run(run);
+}
+#else
+# define sort_and_write(out, lines, linecount) \
+	write_lines((out), (lines), sort_lines((lines), (linecount)))
+#endif
+
 int sort_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int sort_main(int argc UNUSED_PARAM, char **argv)
 {
 	char **lines;
-	char *str_ignored, *str_o, *str_t;
+	char *str_o, *str_t;
+#if !ENABLE_FEATURE_SORT_EXTERNAL
+	char *str_ignored;
+#else
+	char *str_S, *str_T;
+	size_t mem_limit = 0;
+	size_t mem_used = 0;
+#endif
 	llist_t *lst_k = NULL;
-	int i;
+	IF_FEATURE_SORT_BIG(int i;)
 	int linecount;
 	unsigned opts;
 #if ENABLE_FEATURE_SORT_OPTIMIZE_MEMORY
@@ -468,10 +837,19 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 	xfunc_error_retval = 2;
 
 	/* Parse command line options */
+#if ENABLE_FEATURE_SORT_PARALLEL
+	opts = getopt32long(argv,
+			sort_opt_str, sort_longopts,
+			&str_S, &str_T, &str_o, &lst_k, &str_t, &sort_jobs
+	);
+#else
 	opts = getopt32(argv,
 			sort_opt_str,
-			&str_ignored, &str_ignored, &str_o, &lst_k, &str_t
+			IF_FEATURE_SORT_EXTERNAL(&str_S, &str_T,)
+			IF_NOT_FEATURE_SORT_EXTERNAL(&str_ignored, &str_ignored,)
+			&str_o, &lst_k, &str_t
 	);
+#endif
 #if ENABLE_FEATURE_SORT_OPTIMIZE_MEMORY
 	/* Can drop dups only if -u but no "complicating" options,
 	 * IOW: if we do a full line compares. Safe options:
@@ -494,6 +872,20 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 	 */
 	if (opts & FLAG_s)
 		count_to_optimize_dups = (size_t)-1L;
+# if ENABLE_FEATURE_SORT_EXTERNAL
+	/* Lines saved to a run are freed, they must not share memory */
+	if (opts & FLAG_S)
+		count_to_optimize_dups = (size_t)-1L;
+# endif
+#endif
+#if ENABLE_FEATURE_SORT_EXTERNAL
+	/* -c reads everything, no point in spilling */
+	if ((opts & (FLAG_S|FLAG_c)) == FLAG_S) {
+		mem_limit = parse_sort_size(str_S);
+		tmpdir = (opts & FLAG_T) ? str_T : getenv("TMPDIR");
+		if (!tmpdir)
+			tmpdir = "/tmp";
+	}
 #endif
 	/* global b strips leading and trailing spaces */
 	if (opts & FLAG_b)
@@ -557,6 +949,9 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 			}
 		}
 	}
+	/* If no key, perform alphabetic sort */
+	if (!key_list)
+		add_key()->range[0] = 1;
 #endif
 
 	/* Open input files and read data */
@@ -613,14 +1008,22 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 #endif
 			lines = xrealloc_vector(lines, 6, linecount);
 			lines[linecount++] = line;
+#if ENABLE_FEATURE_SORT_EXTERNAL
+			if (mem_limit) {
+				/* Approximate malloc overhead, count lines[] too */
+				mem_used += strlen(line) + 1 + 3 * sizeof(char*);
+				if (mem_used >= mem_limit) {
+					spill_lines(lines, linecount);
+					linecount = 0;
+					mem_used = 0;
+				}
+			}
+#endif
 		}
 		fclose_if_not_stdin(fp);
 	} while (*++argv);
 
 #if ENABLE_FEATURE_SORT_BIG
-	/* If no key, perform alphabetic sort */
-	if (!key_list)
-		add_key()->range[0] = 1;
 	/* Handle -c */
 	if (option_mask32 & FLAG_c) {
 		int j = (option_mask32 & FLAG_u) ? -1 : 0;
@@ -634,44 +1037,13 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 	}
 #endif
 
-	/* For stable sort, store original line position beyond terminating NUL */
-	if (option_mask32 & FLAG_s) {
-		for (i = 0; i < linecount; i++) {
-			uint32_t *p32;
-			char *line;
-			unsigned len;
-
-			line = lines[i];
-			len = (strlen(line) + 4) & (~3u);
-			lines[i] = line = xrealloc(line, len + 4);
-			p32 = (void*)(line + len);
-			*p32 = i;
-		}
-		/*option_mask32 |= FLAG_no_tie_break;*/
-		/* ^^^redundant: if FLAG_s, compare_keys() does no tie break */
-	}
-
-	/* Perform the actual sort */
-	qsort(lines, linecount, sizeof(lines[0]), compare_keys);
-
-	/* Handle -u */
-	if (option_mask32 & FLAG_u) {
-		int j = 0;
-		/* coreutils 6.3 drop lines for which only key is the same:
-		 * - disabling last-resort compare, or else compare_keys()
-		 * will be the same only for completely identical lines
-		 * - disabling -s (same reasons)
-		 */
-		option_mask32 = (option_mask32 | FLAG_no_tie_break) & (~FLAG_s);
-		for (i = 1; i < linecount; i++) {
-			if (compare_keys(&lines[j], &lines[i]) == 0)
-				free(lines[i]);
-			else
-				lines[++j] = lines[i];
-		}
-		if (linecount)
-			linecount = j+1;
+#if ENABLE_FEATURE_SORT_EXTERNAL
+	if (nruns && linecount) {
+		/* Input didn't fit: save the rest, merge all runs */
+		spill_lines(lines, linecount);
+		linecount = 0;
 	}
+#endif
 
 	/* Print it */
 #if ENABLE_FEATURE_SORT_BIG
@@ -679,11 +1051,11 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 	if (option_mask32 & FLAG_o)
 		xmove_fd(xopen(str_o, O_WRONLY|O_CREAT|O_TRUNC), STDOUT_FILENO);
 #endif
-	{
-		int ch = (option_mask32 & FLAG_z) ? '\0' : '\n';
-		for (i = 0; i < linecount; i++)
-			printf("%s%c", lines[i], ch);
-	}
+#if ENABLE_FEATURE_SORT_EXTERNAL
+	if (nruns)
+		merge_runs(runs, nruns, stdout);
+#endif
+	sort_and_write(stdout, lines, linecount);
 
 	fflush_stdout_and_exit_SUCCESS();
 }
@@ -36,6 +36,16 @@
 //config:		-s SEC  Wait SEC seconds between reads with -f
 //config:		-v      Always output headers giving file names
 //config:		-F      Same as -f, but keep retrying
+//config:
+//config:config FEATURE_TAIL_INOTIFY
+//config:	bool "Wait for changes with inotify in -f and -F"
+//config:	default y
+//config:	depends on TAIL && PLATFORM_POSIX
+//config:	help
+//config:	Instead of rereading all followed files every second (-s SEC),
+//config:	sleep until the kernel reports that some of them have changed.
+//config:	Files whose changes inotify can't see, such as those
+//config:	on network filesystems, are still checked periodically.
 
 //applet:IF_TAIL(APPLET(tail, BB_DIR_USR_BIN, BB_SUID_DROP))
 
@@ -70,10 +80,20 @@
 
 #include "libbb.h"
 #include "common_bufsiz.h"
+#if ENABLE_FEATURE_TAIL_INOTIFY
+# include <sys/inotify.h>
+#endif
 
 struct globals {
 	bool from_top;
 	bool exitcode;
+#if ENABLE_FEATURE_TAIL_INOTIFY
+	/* -f: set if some change may go unnoticed, need to poll */
+	bool poll_too;
+	int inotify_fd;
+	int *wd;        /* watch of each file, -1 if not fully watched */
+	bool *changed;  /* files to reread */
+#endif
 } FIX_ALIASING;
 #define G (*(struct globals*)bb_common_bufsiz1)
 #define INIT_G() do { setup_common_bufsiz(); } while (0)
@@ -99,6 +119,164 @@ static ssize_t tail_read(int fd, char *buf, size_t count)
 
 #define header_fmt_str "\n==> %s <==\n"
 
+#if ENABLE_FEATURE_TAIL_INOTIFY
+#define FILE_EVENTS (IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+#define DIR_EVENTS (IN_CREATE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM)
+
+/* Does inotify see all changes of files on this filesystem?
+ * It does not see changes made by other NFS/CIFS/... clients,
+ * and /proc or /sys "files" change without being written to */
+static int fs_notifies(struct statfs *sfs)
+{
+	switch ((unsigned)sfs->f_type) {
+	case 0x6969:     /* NFS */
+	case 0x517b:     /* SMB */
+	case 0xff534d42: /* CIFS */
+	case 0xfe534d42: /* SMB2 */
+	case 0x01021997: /* 9P */
+	case 0x65735546: /* FUSE */
+	case 0x00c36400: /* Ceph */
+	case 0x9fa0:     /* proc */
+	case 0x62656572: /* sysfs */
+		return 0;
+	}
+	return 1;
+}
+
+/* Watch file i. With -F, also watch its directory: the file
+ * may appear, or be replaced, there */
+static void tail_watch(int i, const char *filename, int fd, int retry)
+{
+	struct statfs sfs;
+	struct stat sb;
+	const char *path;
+
+	G.wd[i] = -1;
+	if (G.inotify_fd < 0)
+		return;
+	if (retry) {
+		const char *base = bb_basename(filename);
+		char *dir = (base == filename) ? xstrdup(".") : xstrndup(filename, base - filename);
+
+		if (inotify_add_watch(G.inotify_fd, dir, DIR_EVENTS) < 0
+		 || statfs(dir, &sfs) != 0 || !fs_notifies(&sfs)
+		) {
+			G.poll_too = 1;
+		}
+		free(dir);
+	}
+	if (fd < 0)
+		return; /* -F and the file is not there (yet) */
+	path = (fd == STDIN_FILENO) ? "/proc/self/fd/0" : filename;
+	G.wd[i] = inotify_add_watch(G.inotify_fd, path, FILE_EVENTS);
+	if (G.wd[i] < 0
+	 || fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode)
+	 || fstatfs(fd, &sfs) != 0 || !fs_notifies(&sfs)
+	) {
+		/* Its events, if any, make us check all files */
+		G.wd[i] = -1;
+		G.poll_too = 1;
+	}
+}
+
+/* Stop watching file i, it is being replaced. The same file given
+ * twice shares the watch */
+static void tail_unwatch(unsigned i, unsigned nfiles)
+{
+	unsigned j;
+
+	if (G.wd[i] < 0)
+		return;
+	for (j = 0; j < nfiles; j++)
+		if (j != i && G.wd[j] == G.wd[i])
+			goto shared;
+	inotify_rm_watch(G.inotify_fd, G.wd[i]);
+ shared:
+	G.wd[i] = -1;
+}
+
+/* Sleep until some followed files change (or, if we can't know,
+ * for sleep_period) and mark them in G.changed[] */
+static void tail_wait(unsigned nfiles, unsigned sleep_period)
+{
+	union {
+		struct inotify_event ie;
+		char buf[4 * 1024];
+	} u;
+	struct pollfd pfd;
+	unsigned i;
+	int n;
+
+	pfd.fd = G.inotify_fd;
+	pfd.events = POLLIN;
+	n = -1;
+	if (G.inotify_fd < 0 || G.poll_too)
+		n = (sleep_period < INT_MAX / 1000) ? sleep_period * 1000 : INT_MAX;
+	n = poll(&pfd, G.inotify_fd >= 0, n);
+	if (n <= 0) {
+		/* Timed out (or EINTR): check them all */
+		memset(G.changed, 1, nfiles * sizeof(G.changed[0]));
+		return;
+	}
+	while ((n = read(G.inotify_fd, &u, sizeof(u))) > 0) {
+		char *p = u.buf;
+		while (p < u.buf + n) {
+			struct inotify_event *ie = (void*)p;
+			int found = 0;
+
+			/* Queue overflow has wd -1, same as polled files:
+			 * don't let them match */
+			if (ie->wd >= 0 && !(ie->mask & IN_Q_OVERFLOW)) {
+				for (i = 0; i < nfiles; i++) {
+					if (G.wd[i] == ie->wd) {
+						G.changed[i] = 1;
+						found = 1;
+					}
+				}
+			}
+			/* Directory event, queue overflow... */
+			if (!found)
+				memset(G.changed, 1, nfiles * sizeof(G.changed[0]));
+			p += sizeof(*ie) + ie->len;
+		}
+	}
+}
+#endif
+
+/* Position fd at the start of the last count (> 0) lines of its first
+ * end bytes: read blocks backwards from the end, counting newlines.
+ * This reads only as much as will be printed (rounded up to a block),
+ * no matter how big the file is or how long its lines are */
+static void seek_last_lines(int fd, off_t end, unsigned count, char *buf)
+{
+	off_t pos = end;
+	bool last_block = 1;
+
+	while (pos > 0) {
+		char *p;
+		/* Blocks before the last one are aligned */
+		size_t len = pos % BUFSIZ;
+		if (len == 0)
+			len = BUFSIZ;
+		pos -= len;
+		xlseek(fd, pos, SEEK_SET);
+		if (full_read(fd, buf, len) != (ssize_t)len)
+			break; /* let the caller read (and complain) as usual */
+		p = buf + len;
+		/* A newline at the very end does not start another line */
+		if (last_block && p[-1] == '\n')
+			p--;
+		last_block = 0;
+		while ((p = memrchr(buf, '\n', p - buf)) != NULL) {
+			if (--count == 0) {
+				xlseek(fd, pos + (p - buf) + 1, SEEK_SET);
+				return;
+			}
+		}
+	}
+	xlseek(fd, 0, SEEK_SET);
+}
+
 static unsigned eat_num(const char *p)
 {
 	if (*p == '-')
@@ -189,6 +367,17 @@ int tail_main(int argc, char **argv)
 	if (!nfiles)
 		bb_simple_error_msg_and_die("no files");
 
+#if ENABLE_FEATURE_TAIL_INOTIFY
+	/* Before reading, or changes made meanwhile would be missed */
+	if (FOLLOW) {
+		G.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		G.wd = xmalloc(nfiles * sizeof(G.wd[0]));
+		G.changed = xzalloc(nfiles * sizeof(G.changed[0]));
+		for (i = 0; i < nfiles; i++)
+			tail_watch(i, argv[i], fds[i], FOLLOW_RETRY);
+	}
+#endif
+
 	/* prepare the buffer */
 	tailbufsize = BUFSIZ;
 	if (!G.from_top && COUNT_BYTES) {
@@ -224,7 +413,6 @@ int tail_main(int argc, char **argv)
 		if (!G.from_top) {
 			off_t current = lseek(fd, 0, SEEK_END);
 			if (current > 0) {
-				unsigned off;
 				if (COUNT_BYTES) {
 				/* Optimizing count-bytes case if the file is seekable.
 				 * Beware of backing up too far.
@@ -238,19 +426,14 @@ int tail_main(int argc, char **argv)
 					bb_copyfd_size(fd, STDOUT_FILENO, count);
 					continue;
 				}
-#if 1 /* This is technically incorrect for *LONG* strings, but very useful */
 				/* Optimizing count-lines case if the file is seekable.
-				 * We assume the lines are <64k.
 				 * (Users complain that tail takes too long
 				 * on multi-gigabyte files) */
-				off = (count | 0xf); /* for small counts, be more paranoid */
-				if (off > (INT_MAX / (64*1024)))
-					off = (INT_MAX / (64*1024));
-				current -= off * (64*1024);
-				if (current < 0)
-					current = 0;
-				xlseek(fd, current, SEEK_SET);
-#endif
+				if (count == 0)
+					continue;
+				if (!tailbuf)
+					tailbuf = xmalloc(tailbufsize);
+				seek_last_lines(fd, current, count, tailbuf);
 			}
 		}
 
@@ -339,7 +522,11 @@ int tail_main(int argc, char **argv)
 	fmt = NULL;
 
 	if (FOLLOW) while (1) {
+#if ENABLE_FEATURE_TAIL_INOTIFY
+		tail_wait(nfiles, sleep_period);
+#else
 		sleep(sleep_period);
+#endif
 
 		i = 0;
 		do {
@@ -349,6 +536,11 @@ int tail_main(int argc, char **argv)
 			int new_fd = -1;
 			struct stat sbuf;
 
+#if ENABLE_FEATURE_TAIL_INOTIFY
+			if (!G.changed[i])
+				continue;
+			G.changed[i] = 0;
+#endif
 			if (FOLLOW_RETRY) {
 				struct stat fsbuf;
 
@@ -364,6 +556,10 @@ int tail_main(int argc, char **argv)
 						bb_error_msg("%s has %s; following end of new file",
 							filename, (fd < 0) ? "appeared" : "been replaced"
 						);
+#if ENABLE_FEATURE_TAIL_INOTIFY
+						tail_unwatch(i, nfiles);
+						tail_watch(i, filename, new_fd, 0);
+#endif
 						if (fd < 0) {
 							/* No previously open fd for this file,
 							 * start using new_fd immediately. */
@@ -385,7 +581,12 @@ int tail_main(int argc, char **argv)
 				/* /proc files report zero st_size, don't lseek them */
 				if (fstat(fd, &sbuf) == 0
 				 /* && S_ISREG(sbuf.st_mode) TODO? */
-				 && sbuf.st_size > 0
+				 && (sbuf.st_size > 0
+#if ENABLE_FEATURE_TAIL_INOTIFY
+				/* Not /proc: we were woken by the truncation itself */
+				    || G.wd[i] >= 0
+#endif
+				    )
 				) {
 					off_t current = lseek(fd, 0, SEEK_CUR);
 					if (sbuf.st_size < current) {
@@ -30,6 +30,18 @@
 //config:	* simultaneous use of -f and -e on the command line.
 //config:	This enables the use of awk library files.
 //config:	Example: awk -f mylib.awk -e '{print myfunction($1);}' ...
+//config:	* -k/--csv: records and fields follow CSV quoting rules.
+//config:
+//config:config FEATURE_AWK_BYTECODE
+//config:	bool "Compile arithmetic expressions to bytecode"
+//config:	default y
+//config:	depends on AWK
+//config:	help
+//config:	Numeric expressions on plain variables (loop counters, sums,
+//config:	comparisons) are translated to a linear instruction sequence
+//config:	the first time they run, which is much faster than walking
+//config:	the parse tree. Say N to run everything on the tree walker,
+//config:	e.g. to debug the interpreter.
 
 //applet:IF_AWK(APPLET_NOEXEC(awk, awk, BB_DIR_USR_BIN, BB_SUID_DROP, awk))
 
@@ -43,11 +55,13 @@
 //usage:     "\n	-f/-E FILE	Read program from FILE"
 //usage:	IF_FEATURE_AWK_GNU_EXTENSIONS(
 //usage:     "\n	-e AWK_PROGRAM"
+//usage:     "\n	-k,--csv	Input is CSV: \"quoted\" fields may have , and newlines"
 //usage:	)
 
 #include "libbb.h"
 #include "xregex.h"
 #include <math.h>
+#include <getopt.h>
 
 /* This is a NOEXEC applet. Be very careful! */
 
@@ -77,20 +91,31 @@
  */
 #define OPTSTR_AWK "+" \
 	"F:v:f:" \
-	IF_FEATURE_AWK_GNU_EXTENSIONS("e:E:") \
+	IF_FEATURE_AWK_GNU_EXTENSIONS("e:E:k") \
 	"W:"
 enum {
 	OPTBIT_F,	/* define field separator */
 	OPTBIT_v,	/* define variable */
 	OPTBIT_f,	/* pull in awk program from file */
 	IF_FEATURE_AWK_GNU_EXTENSIONS(OPTBIT_e,) /* -e AWK_PROGRAM */
+	IF_FEATURE_AWK_GNU_EXTENSIONS(OPTBIT_k,) /* -k, --csv */
 	OPTBIT_W,	/* -W ignored */
 	OPT_F = 1 << OPTBIT_F,
 	OPT_v = 1 << OPTBIT_v,
 	OPT_f = 1 << OPTBIT_f,
 	OPT_e = IF_FEATURE_AWK_GNU_EXTENSIONS((1 << OPTBIT_e)) + 0,
+	OPT_k = IF_FEATURE_AWK_GNU_EXTENSIONS((1 << OPTBIT_k)) + 0,
 	OPT_W = 1 << OPTBIT_W
 };
+#if ENABLE_FEATURE_AWK_GNU_EXTENSIONS && ENABLE_LONG_OPTS
+static const struct option awk_longopts[] = {
+	{ "csv", no_argument, NULL, 'k' },
+	{ NULL, 0, NULL, 0 }
+};
+# define awk_getopt(argc, argv) getopt_long(argc, argv, OPTSTR_AWK, awk_longopts, NULL)
+#else
+# define awk_getopt(argc, argv) getopt(argc, argv, OPTSTR_AWK)
+#endif
 
 #define	MAXVARFMT       240
 
@@ -127,8 +152,20 @@ typedef struct var_s {
 		struct var_s *parent;   /* for func args, ptr to actual parameter */
 		walker_list *walker;    /* list of array elements (for..in) */
 	} x;
+	/* short strings (any number formatted with default CONVFMT)
+	 * are kept here instead of malloc'ed, string points here */
+	char sbuf[24];
 } var;
 
+/* Block of temporary variables, used as a stack */
+typedef struct nvblock_s {
+	int size;
+	var *pos;
+	struct nvblock_s *prev;
+	struct nvblock_s *next;
+	var nv[];
+} nvblock;
+
 /* Node chain (pattern-action chain, BEGIN, END, function bodies) */
 typedef struct chain_s {
 	struct node_s *first;
@@ -159,16 +196,20 @@ typedef struct hash_item_s {
 		struct rstream_s rs;    /* redirect streams hash */
 		struct func_s f;        /* functions hash */
 	} data;
-	struct hash_item_s *next;       /* next in chain */
+	struct hash_item_s *next, *prev; /* in order of insertion */
 	char name[1];                   /* really it's longer */
 } hash_item;
 
+/* Open addressing with linear probing, size is a power of 2 */
 typedef struct xhash_s {
 	unsigned nel;           /* num of elements */
-	unsigned csize;         /* current hash size */
-	unsigned nprime;        /* next hash size in PRIMES[] */
+	unsigned mask;          /* current hash size - 1 */
 	unsigned glen;          /* summary length of item names */
-	struct hash_item_s **items;
+	struct hash_slot {
+		unsigned hval;          /* hashidx(item->name) */
+		struct hash_item_s *item;
+	} *slots;
+	struct hash_item_s *first, *last;
 } xhash;
 
 /* Tree node */
@@ -186,10 +227,15 @@ typedef struct node_s {
 	union {
 		struct node_s *n;
 		func *f;
+		/* if TI_REGEXP node: the regex as a fixed string, if it is one */
+		const char *lit;
 	} r;
 	union {
 		struct node_s *n;
 	} a;
+#if ENABLE_FEATURE_AWK_BYTECODE
+	struct bcode_s *bc;     /* compiled form, NULL: not tried yet */
+#endif
 } node;
 
 typedef struct tsplitter_s {
@@ -197,6 +243,27 @@ typedef struct tsplitter_s {
 	regex_t re[2];
 } tsplitter;
 
+/* Compiled dynamic regex: re[0] for IGNORECASE=0, re[1] for IGNORECASE=1,
+ * each compiled on first use (state[] is 0, RE_ERE or RE_BRE) */
+typedef struct re_cache_s {
+	char *s;
+	unsigned used;
+	smallint state[2];
+	regex_t re[2];
+} re_cache;
+
+/* State of splitting a string into fields one at a time */
+typedef struct fsplit_s {
+	const char *s;  /* rest of the string, NULL: no more fields */
+	char *d;        /* next field is stored here */
+	regex_t *re;    /* FS regex or NULL */
+	const char *lit; /* FS as a fixed string (no special chars) or NULL */
+	const char *e;  /* end of the string, if FS is a single byte */
+	int litlen;
+	smallint csv;   /* --csv */
+	char c[4];      /* FS char in both cases, '\n' if RS="" */
+} fsplit;
+
 /* simple token classes */
 /* order and hex values are very important!!!  See next_token() */
 #define TC_LPAREN       (1 << 0)        /* ( */
@@ -578,9 +645,11 @@ static const char vValues[] ALIGN1 =
 	"\034\0"    "\0"        "\377";
 #define str_percent_dot_6g vValues
 
-/* hash size may grow to these values */
-#define FIRST_PRIME 61
-static const uint16_t PRIMES[] ALIGN2 = { 251, 1021, 4093, 16381, 65521 };
+/* initial hash size, it doubles as needed */
+#define HASH_MIN_SIZE 16
+
+/* how many compiled regexes of string patterns ($0 ~ s) to keep */
+#define RE_CACHE_SIZE 8
 
 
 struct globals {
@@ -598,12 +667,15 @@ struct globals {
 	int g_lineno;
 	int num_fields;             /* number of existing $N's */
 	unsigned num_alloc_fields;  /* current size of Fields[] */
+	int max_field_ref;          /* largest constant N in $N in the program */
 	/* NB: Fields[0] corresponds to $1, not to $0 */
 	var *Fields;
+	nvblock *g_cb;
 	char *g_pos;
 	char g_saved_ch;
 	smallint got_program;
 	smallint icase;
+	smallint csv_mode;          /* --csv */
 	smallint exiting;
 	smallint nextrec;
 	smallint nextfile;
@@ -626,6 +698,8 @@ struct globals {
 
 	/* former statics from various functions */
 	char *split_f0__fstrings;
+	int split_f0__fsize;
+	fsplit split_f0__fs;
 
 	unsigned next_input_file__argind;
 	smallint next_input_file__input_file_seen;
@@ -634,7 +708,6 @@ struct globals {
 
 	unsigned evaluate__seed;
 	var *evaluate__fnargs;
-	regex_t evaluate__sreg;
 
 	var ptest__tmpvar;
 	var awk_printf__tmpvar;
@@ -642,10 +715,12 @@ struct globals {
 	var exit__tmpvar;
 	var main__tmpvar;
 
-	tsplitter exec_builtin__tspl;
+	node exec_builtin__tspl;
 
 	/* biggest and least used members go last */
 	tsplitter fsplitter, rsplitter;
+	unsigned re_cache_clock;
+	re_cache re_cache[RE_CACHE_SIZE];
 
 	char g_buf[MAXVARFMT + 1];
 };
@@ -673,11 +748,14 @@ struct globals {
 #define g_lineno     (G.g_lineno    )
 #define num_fields   (G.num_fields  )
 #define num_alloc_fields (G.num_alloc_fields)
+#define max_field_ref (G.max_field_ref)
 #define Fields       (G.Fields      )
+#define g_cb         (G.g_cb        )
 #define g_pos        (G.g_pos       )
 #define g_saved_ch   (G.g_saved_ch  )
 #define got_program  (G.got_program )
 #define icase        (G.icase       )
+#define csv_mode     (G.csv_mode    )
 #define exiting      (G.exiting     )
 #define nextrec      (G.nextrec     )
 #define nextfile     (G.nextfile    )
@@ -725,6 +803,10 @@ static unsigned hashidx(const char *name)
 
 	while (*name)
 		idx = *name++ + (idx << 6) - idx;
+	/* Table index is taken from low bits: mix high bits into them */
+	idx ^= idx >> 16;
+	idx *= 0x45d9f3b;
+	idx ^= idx >> 16;
 	return idx;
 }
 
@@ -734,52 +816,57 @@ static xhash *hash_init(void)
 	xhash *newhash;
 
 	newhash = xzalloc(sizeof(*newhash));
-	newhash->csize = FIRST_PRIME;
-	newhash->items = xzalloc(FIRST_PRIME * sizeof(newhash->items[0]));
+	newhash->mask = HASH_MIN_SIZE - 1;
+	newhash->slots = xzalloc(HASH_MIN_SIZE * sizeof(newhash->slots[0]));
 
 	return newhash;
 }
 
 static void hash_clear(xhash *hash)
 {
-	unsigned i;
 	hash_item *hi, *thi;
 
-	for (i = 0; i < hash->csize; i++) {
-		hi = hash->items[i];
-		while (hi) {
-			thi = hi;
-			hi = hi->next;
+	hi = hash->first;
+	while (hi) {
+		thi = hi;
+		hi = hi->next;
 //FIXME: this assumes that it's a hash of *variables*:
+		if (!(thi->data.v.type & VF_FSTR))
 			free(thi->data.v.string);
-			free(thi);
-		}
-		hash->items[i] = NULL;
+		free(thi);
 	}
+	memset(hash->slots, 0, (hash->mask + 1) * sizeof(hash->slots[0]));
+	hash->first = hash->last = NULL;
 	hash->glen = hash->nel = 0;
 }
 
-#if 0 //UNUSED
 static void hash_free(xhash *hash)
 {
-	hash_clear(hash);
-	free(hash->items);
+	/* Does not free items: fnhash has them in use */
+	free(hash->slots);
 	free(hash);
 }
-#endif
 
-/* find item in hash, return ptr to data, NULL if not found */
-static NOINLINE void *hash_search3(xhash *hash, const char *name, unsigned idx)
+/* find item in hash, return its slot or the empty slot where it belongs */
+static struct hash_slot *hash_lookup(xhash *hash, const char *name, unsigned idx)
 {
-	hash_item *hi;
+	struct hash_slot *slot;
+	unsigned i = idx;
 
-	hi = hash->items[idx % hash->csize];
-	while (hi) {
-		if (strcmp(hi->name, name) == 0)
-			return &hi->data;
-		hi = hi->next;
+	for (;;) {
+		slot = &hash->slots[i & hash->mask];
+		if (!slot->item)
+			return slot;
+		if (slot->hval == idx && strcmp(slot->item->name, name) == 0)
+			return slot;
+		i++;
 	}
-	return NULL;
+}
+
+/* find item in hash, return ptr to data, NULL if not found */
+static NOINLINE void *hash_search3(xhash *hash, const char *name, unsigned idx)
+{
+	return hash_lookup(hash, name, idx)->item;
 }
 
 static void *hash_search(xhash *hash, const char *name)
@@ -787,54 +874,60 @@ static void *hash_search(xhash *hash, const char *name)
 	return hash_search3(hash, name,	hashidx(name));
 }
 
-/* grow hash if it becomes too big */
+/* double the hash size */
 static void hash_rebuild(xhash *hash)
 {
-	unsigned newsize, i, idx;
-	hash_item **newitems, *hi, *thi;
+	unsigned newmask, i, j;
+	struct hash_slot *newslots;
 
-	if (hash->nprime == ARRAY_SIZE(PRIMES))
-		return;
-
-	newsize = PRIMES[hash->nprime++];
-	newitems = xzalloc(newsize * sizeof(newitems[0]));
+	newmask = hash->mask * 2 + 1;
+	newslots = xzalloc((newmask + 1) * sizeof(newslots[0]));
 
-	for (i = 0; i < hash->csize; i++) {
-		hi = hash->items[i];
-		while (hi) {
-			thi = hi;
-			hi = thi->next;
-			idx = hashidx(thi->name) % newsize;
-			thi->next = newitems[idx];
-			newitems[idx] = thi;
-		}
+	for (i = 0; i <= hash->mask; i++) {
+		if (!hash->slots[i].item)
+			continue;
+		j = hash->slots[i].hval;
+		while (newslots[j & newmask].item)
+			j++;
+		newslots[j & newmask] = hash->slots[i];
 	}
 
-	free(hash->items);
-	hash->csize = newsize;
-	hash->items = newitems;
+	free(hash->slots);
+	hash->mask = newmask;
+	hash->slots = newslots;
 }
 
 /* find item in hash, add it if necessary. Return ptr to data */
 static void *hash_find(xhash *hash, const char *name)
 {
+	struct hash_slot *slot;
 	hash_item *hi;
 	unsigned idx;
 	int l;
 
 	idx = hashidx(name);
-	hi = hash_search3(hash, name, idx);
+	slot = hash_lookup(hash, name, idx);
+	hi = slot->item;
 	if (!hi) {
-		if (++hash->nel > hash->csize * 8)
+		/* Keep at least 1/4 of slots empty */
+		if (++hash->nel > hash->mask - (hash->mask >> 2)) {
 			hash_rebuild(hash);
+			slot = hash_lookup(hash, name, idx);
+		}
 
 		l = strlen(name) + 1;
 		hi = xzalloc(sizeof(*hi) + l);
 		strcpy(hi->name, name);
 
-		idx = idx % hash->csize;
-		hi->next = hash->items[idx];
-		hash->items[idx] = hi;
+		slot->hval = idx;
+		slot->item = hi;
+		/* Append to the list: for (k in array) walks in this order */
+		hi->prev = hash->last;
+		if (hash->last)
+			hash->last->next = hi;
+		else
+			hash->first = hi;
+		hash->last = hi;
 		hash->glen += l;
 	}
 	return &hi->data;
@@ -847,20 +940,42 @@ static void *hash_find(xhash *hash, const char *name)
 
 static void hash_remove(xhash *hash, const char *name)
 {
-	hash_item *hi, **phi;
+	struct hash_slot *slot;
+	hash_item *hi;
+	unsigned i, j, k;
 
-	phi = &hash->items[hashidx(name) % hash->csize];
-	while (*phi) {
-		hi = *phi;
-		if (strcmp(hi->name, name) == 0) {
-			hash->glen -= (strlen(name) + 1);
-			hash->nel--;
-			*phi = hi->next;
-			free(hi);
+	slot = hash_lookup(hash, name, hashidx(name));
+	hi = slot->item;
+	if (!hi)
+		return;
+	hash->glen -= (strlen(name) + 1);
+	hash->nel--;
+	if (hi->prev)
+		hi->prev->next = hi->next;
+	else
+		hash->first = hi->next;
+	if (hi->next)
+		hi->next->prev = hi->prev;
+	else
+		hash->last = hi->prev;
+	free(hi);
+
+	/* Linear probing: move back following items which would not be
+	 * found past the hole anymore (no "deleted" markers needed) */
+	i = slot - hash->slots;
+	j = i;
+	for (;;) {
+		j = (j + 1) & hash->mask;
+		if (!hash->slots[j].item)
 			break;
-		}
-		phi = &hi->next;
+		k = hash->slots[j].hval & hash->mask;
+		/* Item at j can stay if its home k is cyclically in (i, j] */
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		hash->slots[i] = hash->slots[j];
+		i = j;
 	}
+	hash->slots[i].item = NULL;
 }
 
 /* ------ some useful functions ------ */
@@ -930,6 +1045,26 @@ static ALWAYS_INLINE int isalnum_(int c)
 static double my_strtod(char **pp)
 {
 	char *cp = *pp;
+	char *p = cp;
+	unsigned long long ull;
+	unsigned n;
+
+	/* Plain decimal integers (most numeric fields) are parsed here,
+	 * strtod() is several times slower. Up to 15 digits are exact
+	 * in a double. Anything fancier goes to strtod().
+	 */
+	if (*p == '-' || *p == '+')
+		p++;
+	ull = 0;
+	for (n = 0; n < 16 && (unsigned char)(*p - '0') <= 9; n++)
+		ull = ull * 10 + (*p++ - '0');
+	if (n != 0 && n < 16
+	 && (*p == '\0' || !strchr(".eExX", *p)) /* strchr finds the NUL too */
+	) {
+		double d = ull;
+		*pp = p;
+		return (*cp == '-') ? -d : d;
+	}
 	return strtod(cp, pp);
 }
 #if ENABLE_DESKTOP
@@ -964,7 +1099,20 @@ static double my_strtod_or_hexoct(char **pp)
 static const char *fmt_num(const char *format, double n)
 {
 	if (n == (long long)n) {
-		snprintf(g_buf, MAXVARFMT, "%"LL_FMT"d", (long long)n);
+		/* Same as "%lld" but without snprintf() overhead */
+		long long ll = (long long)n;
+		unsigned long long ull = ll < 0 ? -(unsigned long long)ll : ll;
+		char buf[sizeof(long long)*3 + 2];
+		char *p = buf + sizeof(buf);
+
+		*--p = '\0';
+		do {
+			*--p = '0' + ull % 10;
+			ull /= 10;
+		} while (ull);
+		if (ll < 0)
+			*--p = '-';
+		strcpy(g_buf, p);
 	} else {
 		const char *s = format;
 		char c;
@@ -995,6 +1143,25 @@ static xhash *iamarray(var *a)
 
 #define clear_array(array) hash_clear(array)
 
+/* set var::string to a copy of s (the var must be clear) */
+static void setvar_copy(var *v, const char *s)
+{
+	size_t len = strlen(s);
+
+	/* Not for Fields[]: fsrealloc() moves them, and someone
+	 * may still hold a string obtained from $N (see exec_builtin) */
+	if (len < sizeof(v->sbuf)
+	 && ((uintptr_t)v < (uintptr_t)Fields
+	    || (uintptr_t)v >= (uintptr_t)Fields + num_alloc_fields * sizeof(Fields[0]))
+	) {
+		v->string = memcpy(v->sbuf, s, len + 1);
+		v->type |= VF_FSTR;
+	} else {
+		v->string = xstrdup(s);
+		v->type &= ~VF_FSTR;
+	}
+}
+
 /* clear a variable */
 static var *clrvar(var *v)
 {
@@ -1073,7 +1240,7 @@ static const char *getvar_s(var *v)
 		if (v != intvar[CONVFMT])
 			convfmt = getvar_s(intvar[CONVFMT]);
 		/* Convert the value */
-		v->string = xstrdup(fmt_num(convfmt, v->number));
+		setvar_copy(v, fmt_num(convfmt, v->number));
 		v->type |= VF_CACHED;
 	}
 	return (v->string == NULL) ? "" : v->string;
@@ -1128,7 +1295,7 @@ static var *copyvar(var *dest, const var *src)
 		debug_printf_eval("copyvar: number:%f string:'%s'\n", src->number, src->string);
 		dest->number = src->number;
 		if (src->string)
-			dest->string = xstrdup(src->string);
+			setvar_copy(dest, src->string);
 	}
 	handle_special(dest);
 	return dest;
@@ -1390,10 +1557,17 @@ static node *new_node(uint32_t info)
 	return n;
 }
 
+/* regex s matches only itself: it can be searched for with strstr() */
+static int is_re_literal(const char *s)
+{
+	return s[0] && !strpbrk(s, "\\^$.[]|()*+?{}");
+}
+
 static void mk_re_node(const char *s, node *n, regex_t *re)
 {
 	n->info = TI_REGEXP;
 	n->l.re = re;
+	n->r.lit = is_re_literal(s) ? xstrdup(s) : NULL;
 	xregcomp(re, s, REG_EXTENDED);
 	xregcomp(re + 1, s, REG_EXTENDED | REG_ICASE);
 }
@@ -1539,6 +1713,12 @@ static node *parse_expr(uint32_t term_tc)
 			v = cn->l.v = xzalloc(sizeof(var));
 			if (tc & TC_NUMBER) {
 				setvar_i(v, t_double);
+				/* $N: have room for N fields before splitting */
+				if ((vn->info & OPCLSMASK) == OC_FIELD
+				 && t_double > max_field_ref && t_double < 1024
+				) {
+					max_field_ref = t_double;
+				}
 			 } else {
 				setvar_s(v, t_string);
 			}
@@ -1909,10 +2089,41 @@ static void parse_program(char *p)
 
 /* -------- program execution part -------- */
 
-/* temporary variables allocator */
+/* temporary variables allocator: evaluate() and function calls
+ * take and release them in LIFO order, a malloc per call is too slow */
 static var *nvalloc(int sz)
 {
-	return xzalloc(sz * sizeof(var));
+	nvblock *cb = g_cb;
+	var *v;
+
+	if (!cb || cb->pos + sz > cb->nv + cb->size) {
+		if (cb && cb->next && cb->next->size >= sz) {
+			cb = cb->next;
+		} else {
+			nvblock *nb;
+			int size = sz > 64 ? sz : 64;
+
+			if (cb) {
+				/* unused blocks past this one are too small */
+				while ((nb = cb->next) != NULL) {
+					cb->next = nb->next;
+					free(nb);
+				}
+			}
+			nb = xmalloc(sizeof(*nb) + size * sizeof(var));
+			nb->size = size;
+			nb->prev = cb;
+			nb->next = NULL;
+			if (cb)
+				cb->next = nb;
+			cb = nb;
+		}
+		cb->pos = cb->nv;
+		g_cb = cb;
+	}
+	v = cb->pos;
+	cb->pos += sz;
+	return memset(v, 0, sz * sizeof(var));
 }
 
 static void nvfree(var *v, int sz)
@@ -1922,8 +2133,7 @@ static void nvfree(var *v, int sz)
 	while (--sz >= 0) {
 		if ((p->type & (VF_ARRAY | VF_CHILD)) == VF_ARRAY) {
 			clear_array(iamarray(p));
-			free(p->x.array->items);
-			free(p->x.array);
+			hash_free(p->x.array);
 		}
 		if (p->type & VF_WALK) {
 			walker_list *n;
@@ -1941,7 +2151,11 @@ static void nvfree(var *v, int sz)
 		p++;
 	}
 
-	free(v);
+	/* v is the last allocation in g_cb, or in one of previous blocks
+	 * if a bigger nvalloc() did not fit into them */
+	while (v < g_cb->nv || v > g_cb->nv + g_cb->size)
+		g_cb = g_cb->prev;
+	g_cb->pos = v;
 }
 
 static node *mk_splitter(const char *s, tsplitter *spl)
@@ -1954,6 +2168,7 @@ static node *mk_splitter(const char *s, tsplitter *spl)
 	if (n->info == TI_REGEXP) {
 		regfree(re);
 		regfree(re + 1);
+		free((char*)n->r.lit);
 	}
 	if (s[0] && s[1]) { /* strlen(s) > 1 */
 		mk_re_node(s, n, re);
@@ -1964,17 +2179,71 @@ static node *mk_splitter(const char *s, tsplitter *spl)
 	return n;
 }
 
-static var *evaluate(node *, var *);
-
-/* Use node as a regular expression. Supplied with node ptr and regex_t
- * storage space. Return ptr to regex (if result points to preg, it should
- * be later regfree'd manually).
+/* Compiled regex for pattern string s, from a small LRU cache: in
+ * per-record code like '$0 ~ pat' the same few patterns come again and
+ * again. The result stays valid until the next get_regex() call.
+ * With ere_only, die (like xregcomp) if s is not a valid ERE instead of
+ * falling back to a basic regex.
  */
-static regex_t *as_regex(node *op, regex_t *preg)
+#define RE_ERE 1
+#define RE_BRE 2
+static regex_t *get_regex(const char *s, int ere_only)
 {
+	re_cache *e, *lru;
 	int cflags;
-	const char *s;
 
+	lru = e = G.re_cache;
+	for (; e < G.re_cache + RE_CACHE_SIZE; e++) {
+		if (!e->s) {
+			lru = e;
+			break;
+		}
+		if (strcmp(e->s, s) == 0)
+			goto hit;
+		if (e->used < lru->used)
+			lru = e;
+	}
+	e = lru;
+	if (e->s) {
+		free(e->s);
+		if (e->state[0])
+			regfree(&e->re[0]);
+		if (e->state[1])
+			regfree(&e->re[1]);
+	}
+	e->s = xstrdup(s);
+	e->state[0] = e->state[1] = 0;
+ hit:
+	e->used = ++G.re_cache_clock;
+
+	if (!e->state[icase]) {
+		cflags = icase ? REG_EXTENDED | REG_ICASE : REG_EXTENDED;
+		/* Testcase where REG_EXTENDED fails (unpaired '{'):
+		 * echo Hi | awk 'gsub("@(samp|code|file)\{","");'
+		 * gawk 3.1.5 eats this. We revert to ~REG_EXTENDED
+		 * (maybe gsub is not supposed to use REG_EXTENDED?).
+		 */
+		e->state[icase] = RE_ERE;
+		if (regcomp(&e->re[icase], s, cflags)) {
+			e->state[icase] = RE_BRE;
+			cflags &= ~REG_EXTENDED;
+			xregcomp(&e->re[icase], s, cflags);
+		}
+	}
+	if (ere_only && e->state[icase] == RE_BRE) {
+		regex_t re;
+		xregcomp(&re, s, icase ? REG_EXTENDED | REG_ICASE : REG_EXTENDED);
+	}
+	return e->re;
+}
+
+static var *evaluate(node *, var *);
+
+/* Use node as a regular expression. The result must not be regfree'd:
+ * it is either the node's own regex or a get_regex() one.
+ */
+static regex_t *as_regex(node *op)
+{
 	if (op->info == TI_REGEXP) {
 		return &op->l.re[icase];
 	}
@@ -1985,21 +2254,9 @@ static regex_t *as_regex(node *op, regex_t *preg)
 	// to decrease memory consumption in deeply-recursive awk programs.
 	// The rule to work safely is to never call evaluate() while our static
 	// TMPVAR's value is still needed.
-	s = getvar_s(evaluate(op, TMPVAR));
-
-	cflags = icase ? REG_EXTENDED | REG_ICASE : REG_EXTENDED;
-	/* Testcase where REG_EXTENDED fails (unpaired '{'):
-	 * echo Hi | awk 'gsub("@(samp|code|file)\{","");'
-	 * gawk 3.1.5 eats this. We revert to ~REG_EXTENDED
-	 * (maybe gsub is not supposed to use REG_EXTENDED?).
-	 */
-	if (regcomp(preg, s, cflags)) {
-		cflags &= ~REG_EXTENDED;
-		xregcomp(preg, s, cflags);
-	}
+	return &get_regex(getvar_s(evaluate(op, TMPVAR)), 0)[icase];
 	//nvfree(tmpvar, 1);
 #undef TMPVAR
-	return preg;
 }
 
 /* gradually increasing buffer.
@@ -2026,7 +2283,7 @@ static void fsrealloc(int size)
 			bb_die_memory_exhausted();
 
 		i = num_alloc_fields;
-		num_alloc_fields = size + 16;
+		num_alloc_fields = size + (size >> 1) + 16;
 
 		newsize = num_alloc_fields * sizeof(Fields[0]);
 		debug_printf_eval("fsrealloc: xrealloc(%p, %u)\n", Fields, newsize);
@@ -2069,121 +2326,246 @@ static int regexec1_nonempty(const regex_t *preg, const char *s, regmatch_t pmat
 	return r;
 }
 
-static int awk_split(const char *s, node *spl, char **slist)
+static void fsplit_init(fsplit *fs, const char *s, node *spl, char *buf)
 {
-	int n;
-	char c[4];
-	char *s1;
-
-	/* in worst case, each char would be a separate field */
-	*slist = s1 = xzalloc(strlen(s) * 2 + 3);
-	strcpy(s1, s);
+	fs->s = *s ? s : NULL; /* "": zero fields */
+	fs->d = buf;
+	fs->re = NULL;
+	fs->lit = NULL;
+	fs->e = NULL;
+	/* with --csv, FS is not used: $0 and split() without
+	 * a separator split by CSV rules */
+	fs->csv = (csv_mode && spl == &fsplitter.n);
+	if (spl->info == TI_REGEXP && !fs->csv) {
+		if (spl->r.lit && !icase) {
+			fs->lit = spl->r.lit;
+			fs->litlen = strlen(fs->lit);
+		} else
+			fs->re = &spl->l.re[icase];
+	}
 
-	c[0] = c[1] = (char)spl->info;
-	c[2] = c[3] = '\0';
+	fs->c[0] = fs->c[1] = (char)spl->info;
+	fs->c[2] = fs->c[3] = '\0';
 	if (*getvar_s(intvar[RS]) == '\0')
-		c[2] = '\n';
+		fs->c[2] = '\n';
+	if (icase) {
+		fs->c[0] = toupper(fs->c[0]);
+		fs->c[1] = tolower(fs->c[1]);
+	}
+	/* the common -F, and -F'\t': find it with memchr() */
+	if (!fs->re && !fs->lit && !fs->csv && fs->s
+	 && fs->c[0] != ' ' && fs->c[0] != '\0'
+	 && fs->c[0] == fs->c[1] && fs->c[2] == '\0'
+	) {
+		fs->e = s + strlen(s);
+	}
+}
 
-	n = 0;
-	if (spl->info == TI_REGEXP) {  /* regex split */
-		if (!*s)
-			return n; /* "": zero fields */
-		n++; /* at least one field will be there */
-		do {
-			int l;
-			regmatch_t pmatch[1];
+/* --csv field: comma separated, in "double quotes" commas and newlines
+ * are not special and "" is a quote. Stored into fs->d without quotes */
+static char *fsplit_next_csv(fsplit *fs)
+{
+	const char *s = fs->s;
+	char *d, *f;
 
-			l = strcspn(s, c+2); /* len till next NUL or \n */
-			if (regexec1_nonempty(&spl->l.re[icase], s, pmatch) == 0
-			 && pmatch[0].rm_so <= l
-			) {
-				/* if (pmatch[0].rm_eo == 0) ... - impossible */
-				l = pmatch[0].rm_so;
-				n++; /* we saw yet another delimiter */
-			} else {
-				pmatch[0].rm_eo = l;
-				if (s[l])
-					pmatch[0].rm_eo++;
+	f = d = fs->d;
+	if (*s == '"') {
+		s++;
+		while (*s) {
+			if (*s == '"') {
+				if (s[1] != '"') {
+					s++;
+					break;
+				}
+				s++;
 			}
-			s1 = mempcpy(s1, s, l);
-			*s1++ = '\0';
-			s += pmatch[0].rm_eo;
-		} while (*s);
+			*d++ = *s++;
+		}
+	}
+	/* unquoted field, or text after the closing quote */
+	while (*s && *s != ',')
+		*d++ = *s++;
+	*d = '\0';
+	fs->d = d + 1;
+	fs->s = *s ? s + 1 : NULL; /* after ',' another field follows */
+	return f;
+}
 
-		/* echo a-- | awk -F-- '{ print NF, length($NF), $NF }'
-		 * should print "2 0 ":
-		 */
-		*s1 = '\0';
+/* store the next field into fs->d, return it or NULL if no more */
+static char *fsplit_next(fsplit *fs)
+{
+	const char *s = fs->s;
+	const char *f = s;
+	char *d;
+	int l;
 
-		return n;
-	}
-	if (c[0] == '\0') {  /* null split */
-		while (*s) {
-			*s1++ = *s++;
-			*s1++ = '\0';
-			n++;
+	if (!s)
+		return NULL;
+
+	if (fs->e) {  /* single byte split */
+		const char *p = memchr(s, fs->c[0], fs->e - s);
+		if (p) {
+			l = p - s;
+			s = p + 1; /* another field follows, maybe empty */
+		} else {
+			l = fs->e - s;
+			s = NULL;
 		}
-		return n;
-	}
-	if (c[0] != ' ') {  /* single-character split */
-		if (icase) {
-			c[0] = toupper(c[0]);
-			c[1] = tolower(c[1]);
+	} else if (fs->lit) {  /* fixed string split */
+		const char *p = *s ? strstr(s, fs->lit) : NULL;
+		if (p && fs->c[2]) {
+			/* RS="": newline separates fields too */
+			l = strcspn(s, fs->c + 2);
+			if (p - s > l)
+				p = NULL;
 		}
-		if (*s1)
-			n++;
-		while ((s1 = strpbrk(s1, c)) != NULL) {
-			*s1++ = '\0';
-			n++;
+		if (p) {
+			l = p - s;
+			s = p + fs->litlen;
+		} else {
+			l = strcspn(s, fs->c + 2);
+			s += l;
+			if (*s)
+				s++;
+			if (!*s)
+				s = NULL;
 		}
-		return n;
-	}
-	/* space split: "In the special case that FS is a single space,
-	 * fields are separated by runs of spaces and/or tabs and/or newlines"
-	 */
-	while (*s) {
+	} else if (fs->csv) {
+		return fsplit_next_csv(fs);
+	} else if (fs->re) {  /* regex split */
+		regmatch_t pmatch[1];
+
+		l = strcspn(s, fs->c + 2); /* len till next NUL or \n */
+		/* echo a-- | awk -F-- '{ print NF, length($NF), $NF }'
+		 * should print "2 0 ": *s == '\0' here is that empty field
+		 */
+		if (*s
+		 && regexec1_nonempty(fs->re, s, pmatch) == 0
+		 && pmatch[0].rm_so <= l
+		) {
+			/* if (pmatch[0].rm_eo == 0) ... - impossible */
+			l = pmatch[0].rm_so;
+			s += pmatch[0].rm_eo; /* another field follows */
+		} else {
+			s += l;
+			if (*s)
+				s++;
+			if (!*s)
+				s = NULL;
+		}
+	} else if (fs->c[0] == '\0') {  /* null split */
+		l = 1;
+		s++;
+		if (!*s)
+			s = NULL;
+	} else if (fs->c[0] != ' ') {  /* single-character split */
+		l = strcspn(s, fs->c);
+		s += l;
+		if (*s)
+			s++; /* another field follows, maybe empty */
+		else
+			s = NULL;
+	} else {
+		/* space split: "In the special case that FS is a single space,
+		 * fields are separated by runs of spaces and/or tabs and/or newlines"
+		 */
 		/* s = skip_whitespace(s); -- WRONG (also skips \v \f \r) */
 		while (*s == ' ' || *s == '\t' || *s == '\n')
 			s++;
-		if (!*s)
-			break;
-		n++;
+		if (!*s) {
+			fs->s = NULL;
+			return NULL;
+		}
+		f = s;
 		while (*s && !(*s == ' ' || *s == '\t' || *s == '\n'))
-			*s1++ = *s++;
-		*s1++ = '\0';
+			s++;
+		l = s - f;
 	}
+	fs->s = s;
+	d = fs->d;
+	memcpy(d, f, l);
+	d[l] = '\0';
+	fs->d = d + l + 1;
+	return d;
+}
+
+static int awk_split(const char *s, node *spl, char **slist)
+{
+	fsplit fs;
+	int n;
+
+	/* in worst case, each char would be a separate field */
+	*slist = xmalloc(strlen(s) * 2 + 3);
+	fsplit_init(&fs, s, spl, *slist);
+
+	n = 0;
+	while (fsplit_next(&fs))
+		n++;
 	return n;
 }
 
-static void split_f0(void)
+/* split $0 up to field n (or all of it). Fields are split when they are
+ * used: a program looking at $1 does not pay for tokenizing 200 columns */
+static void split_f0_upto(int n)
 {
 /* static char *fstrings; */
 #define fstrings (G.split_f0__fstrings)
+#define fs (G.split_f0__fs)
 
-	int i, n;
-	char *s;
+	char *f;
 
 	if (is_f0_split)
 		return;
 
-	is_f0_split = TRUE;
-	free(fstrings);
-	fsrealloc(0);
-	n = awk_split(getvar_s(intvar[F0]), &fsplitter.n, &fstrings);
-	fsrealloc(n);
-	s = fstrings;
-	for (i = 0; i < n; i++) {
-		Fields[i].string = nextword(&s);
-		Fields[i].type |= (VF_FSTR | VF_USER | VF_DIRTY);
-	}
-
-	/* set NF manually to avoid side effects */
-	clrvar(intvar[NF]);
-	intvar[NF]->type = VF_NUMBER | VF_SPECIAL;
-	intvar[NF]->number = num_fields;
+	if (!fs.d) {
+		const char *s = getvar_s(intvar[F0]);
+
+		fstrings = qrealloc(fstrings, strlen(s) * 2 + 3, &G.split_f0__fsize);
+		/* room for all fields the program names, so that
+		 * splitting further does not move Fields[] */
+		if (max_field_ref >= num_alloc_fields)
+			fsrealloc(max_field_ref);
+		fsrealloc(0);
+		fsplit_init(&fs, s, &fsplitter.n, fstrings);
+	}
+	while (num_fields < n) {
+		f = fsplit_next(&fs);
+		if (!f) {
+			is_f0_split = TRUE;
+			fs.d = NULL;
+			/* set NF manually to avoid side effects */
+			clrvar(intvar[NF]);
+			intvar[NF]->type = VF_NUMBER | VF_SPECIAL;
+			intvar[NF]->number = num_fields;
+			return;
+		}
+		fsrealloc(num_fields + 1);
+		Fields[num_fields - 1].string = f;
+		Fields[num_fields - 1].type |= (VF_FSTR | VF_USER | VF_DIRTY);
+	}
+#undef fs
 #undef fstrings
 }
 
+static void split_f0(void)
+{
+	split_f0_upto(INT_MAX);
+}
+
+/* $N is going to be changed: NF and $0 are recalculated from all fields,
+ * so finish splitting them now (if $0 was changed meanwhile, Fields[]
+ * are used as they are). Returns v, which may have moved */
+static var *field_lvalue(var *v)
+{
+	size_t i = v - Fields;
+
+	if (G.split_f0__fs.d && i < num_alloc_fields) {
+		split_f0();
+		v = Fields + i;
+	}
+	return v;
+}
+
 /* perform additional actions when some internal variables changed */
 static void handle_special(var *v)
 {
@@ -2224,6 +2606,7 @@ static void handle_special(var *v)
 
 	} else if (v == intvar[F0]) {
 		is_f0_split = FALSE;
+		G.split_f0__fs.d = NULL;
 
 	} else if (v == intvar[FS]) {
 		/*
@@ -2244,8 +2627,12 @@ static void handle_special(var *v)
 	} else if (v == intvar[IGNORECASE]) {
 		icase = istrue(v);
 	} else {				/* $n */
+		i = v - Fields;
+		/* callers use field_lvalue(), this is just in case */
+		if (G.split_f0__fs.d)
+			split_f0();
 		n = getvar_i(intvar[NF]);
-		setvar_i(intvar[NF], n > v-Fields ? n : v-Fields+1);
+		setvar_i(intvar[NF], n > i ? n : i+1);
 		/* right here v is invalid. Just to note... */
 	}
 }
@@ -2268,7 +2655,6 @@ static node *nextarg(node **pn)
 static void hashwalk_init(var *v, xhash *array)
 {
 	hash_item *hi;
-	unsigned i;
 	walker_list *w;
 	walker_list *prev_walker;
 
@@ -2284,13 +2670,8 @@ static void hashwalk_init(var *v, xhash *array)
 	debug_printf_walker(" walker@%p=%p\n", &v->x.walker, w);
 	w->cur = w->end = w->wbuf;
 	w->prev = prev_walker;
-	for (i = 0; i < array->csize; i++) {
-		hi = array->items[i];
-		while (hi) {
-			w->end = stpcpy(w->end, hi->name) + 1;
-			hi = hi->next;
-		}
-	}
+	for (hi = array->first; hi; hi = hi->next)
+		w->end = stpcpy(w->end, hi->name) + 1;
 }
 
 static int hashwalk_next(var *v)
@@ -2321,6 +2702,20 @@ static int ptest(node *pattern)
 }
 
 /* read next record from stream rsm into a variable v */
+/* --csv: the newline which ends the record at s, not one in quotes */
+static char *csv_eol(char *s)
+{
+	smallint quoted = 0;
+
+	for (; *s; s++) {
+		if (*s == '"')
+			quoted ^= 1;
+		else if (*s == '\n' && !quoted)
+			return s;
+	}
+	return NULL;
+}
+
 static int awk_getline(rstream *rsm, var *v)
 {
 	char *b;
@@ -2358,12 +2753,15 @@ static int awk_getline(rstream *rsm, var *v)
 						break;
 				}
 			} else if (c != '\0') {
-				s = strchr(b+pp, c);
+				s = (csv_mode && c == '\n') ? csv_eol(b) : strchr(b+pp, c);
 				if (!s)
 					s = memchr(b+pp, '\0', p - pp);
 				if (s) {
 					so = eo = s-b;
 					eo++;
+					/* --csv: CRLF line ends too */
+					if (csv_mode && *s == '\n' && so > 0 && s[-1] == '\r')
+						so--;
 					break;
 				}
 			} else {
@@ -2698,7 +3096,7 @@ static int awk_sub(node *rn, const char *repl, int nm, var *src, var *dest /*,in
 	int match_no, residx, replen, resbufsize;
 	int regexec_flags;
 	regmatch_t pmatch[10];
-	regex_t sreg, *regex;
+	regex_t *regex;
 	/* True only if called to implement gensub(): */
 	int subexp = (src != dest);
 #if defined(REG_STARTEND)
@@ -2711,7 +3109,7 @@ static int awk_sub(node *rn, const char *repl, int nm, var *src, var *dest /*,in
 	resbuf = NULL;
 	residx = 0;
 	match_no = 0;
-	regex = as_regex(rn, &sreg);
+	regex = as_regex(rn);
 	sp = getvar_s(src ? src : intvar[F0]);
 #if defined(REG_STARTEND)
 	src_string = sp;
@@ -2799,8 +3197,6 @@ static int awk_sub(node *rn, const char *repl, int nm, var *src, var *dest /*,in
  ret:
 	//bb_error_msg("end sp:'%s'%p", sp,sp);
 	setvar_p(dest ? dest : intvar[F0], resbuf);
-	if (regex == &sreg)
-		regfree(regex);
 	return match_no;
 }
 
@@ -2836,13 +3232,9 @@ static NOINLINE int do_mktime(const char *ds)
 static NOINLINE var *do_match(node *an1, const char *as0)
 {
 	regmatch_t pmatch[1];
-	regex_t sreg, *re;
 	int n, start, len;
 
-	re = as_regex(an1, &sreg);
-	n = regexec(re, as0, 1, pmatch, 0);
-	if (re == &sreg)
-		regfree(re);
+	n = regexec(as_regex(an1), as0, 1, pmatch, 0);
 	start = 0;
 	len = -1;
 	if (n == 0) {
@@ -2877,11 +3269,22 @@ static NOINLINE var *exec_builtin(node *op, var *res)
 	isr = info = op->info;
 	op = op->l.n;
 
-	av[2] = av[3] = NULL;
+	av[0] = av[1] = av[2] = av[3] = NULL;
 	for (i = 0; i < 4 && op; i++) {
 		an[i] = nextarg(&op);
 		if (isr & 0x09000000) {
+			var *old_Fields = Fields;
+			unsigned old_num_alloc = num_alloc_fields;
+
 			av[i] = evaluate(an[i], TMPVAR(i));
+			if (Fields != old_Fields) {
+				/* $N in this argument split more fields and moved
+				 * Fields[]: fix up $Ms of previous arguments */
+				for (l = 0; l < i; l++) {
+					if (av[l] && (size_t)(av[l] - old_Fields) < old_num_alloc)
+						av[l] = Fields + (av[l] - old_Fields);
+				}
+			}
 			if (isr & 0x08000000)
 				as[i] = getvar_s(av[i]);
 		}
@@ -2906,8 +3309,17 @@ static NOINLINE var *exec_builtin(node *op, var *res)
 		char *s, *s1;
 
 		if (nargs > 2) {
-			spl = (an[2]->info == TI_REGEXP) ? an[2]
-				: mk_splitter(getvar_s(evaluate(an[2], TMPVAR2)), &tspl);
+			spl = an[2];
+			if (spl->info != TI_REGEXP) {
+				const char *sep = getvar_s(evaluate(an[2], TMPVAR2));
+				spl = &tspl;
+				spl->info = (uint32_t) sep[0];
+				if (sep[0] && sep[1]) { /* strlen(sep) > 1 */
+					spl->info = TI_REGEXP;
+					spl->l.re = get_regex(sep, 1);
+					spl->r.lit = is_re_literal(sep) ? sep : NULL;
+				}
+			}
 		} else {
 			spl = &fsplitter.n;
 		}
@@ -3024,10 +3436,14 @@ static NOINLINE var *exec_builtin(node *op, var *res)
 		break;
 
 	case B_gs: /* gsub(regex, repl, string) */
+		if (av[2])
+			av[2] = field_lvalue(av[2]);
 		setvar_i(res, awk_sub(an[0], as[1], /*matchnum:all*/0, /*src:*/av[2], /*dst:*/av[2]/*, FALSE*/));
 		break;
 
 	case B_su: /* sub(regex, repl, string) */
+		if (av[2])
+			av[2] = field_lvalue(av[2]);
 		setvar_i(res, awk_sub(an[0], as[1], /*matchnum:first*/1, /*src:*/av[2], /*dst:*/av[2]/*, FALSE*/));
 		break;
 	}
@@ -3138,13 +3554,413 @@ static unsigned triple32(unsigned x)
 }
 #endif
 
+#define XC(n) ((n) >> 8)
+
+#if ENABLE_FEATURE_AWK_BYTECODE
+/*
+ * Numeric expressions over plain variables, function arguments and
+ * constants are compiled to a linear instruction sequence and run on
+ * a small value stack: no recursion and no temporary vars per node.
+ * Anything else (strings, arrays, fields, calls...) is left to the
+ * tree walker, which also runs compiled subexpressions of it.
+ * Compilation happens the first time evaluate() sees a node.
+ */
+enum {
+	BC_END,
+	BC_NUM,      /* push u.d */
+	BC_VAR,      /* push var's numeric value, or var itself if ref */
+	BC_BINARY,   /* opn is one of "+-* /%&" as in OC_BINARY */
+	BC_NEG,
+	BC_NOT,
+	BC_INCR,     /* opn: 'P'/'M' pre-, 'p'/'m' post-increment/decrement */
+	BC_COMPARE,  /* opn as in OC_COMPARE */
+	BC_LAND,     /* short circuit to arg */
+	BC_LOR,
+	BC_BOOL,
+	BC_MOVE,
+	BC_REPLACE,  /* opn as in OC_REPLACE */
+};
+
+typedef struct bc_insn_s {
+	uint8_t code;
+	uint8_t opn;
+	uint8_t ref;     /* push var itself, its type matters (comparisons) */
+	int arg;         /* jump target; fnargs[] index if u.v is NULL */
+	union {
+		var *v;
+		double d;
+	} u;
+} bc_insn;
+
+typedef struct bcode_s {
+	bc_insn code[1];
+} bcode;
+
+/* compiled expressions have a bounded size, others stay trees */
+#define BC_MAX_CODE  64
+#define BC_MAX_STACK 16
+/* node->bc of nodes which can't be compiled */
+#define BC_NONE ((bcode*)(uintptr_t)1)
+
+struct bc_compiler {
+	int n;
+	int depth;
+	int max_depth;
+	bc_insn code[BC_MAX_CODE];
+};
+
+static bc_insn *bc_add(struct bc_compiler *c, int code, int push)
+{
+	bc_insn *in;
+
+	if (c->n >= BC_MAX_CODE - 1)
+		return NULL;
+	c->depth += push;
+	if (c->max_depth < c->depth)
+		c->max_depth = c->depth;
+	in = &c->code[c->n++];
+	memset(in, 0, sizeof(*in));
+	in->code = code;
+	return in;
+}
+
+/* Plain variable or function argument: fill in u.v or arg */
+static int bc_leaf_var(node *op, bc_insn *in)
+{
+	if (op->info == OC_VAR) {
+		in->u.v = op->l.v;
+		return 1;
+	}
+	if (op->info == OC_FNARG) {
+		in->arg = op->l.aidx;
+		return 1;
+	}
+	return 0;
+}
+
+/* assignment target: plain non-special variable or function argument */
+static int bc_target(node *op, bc_insn *in)
+{
+	if (!op || !bc_leaf_var(op, in))
+		return 0;
+	return !in->u.v || !(in->u.v->type & VF_SPECIAL);
+}
+
+/* Emit code computing op. If ref, a plain variable operand is pushed
+ * as is, not as its numeric value (comparisons and truth tests look
+ * at its type, and at its value when they are done, not before) */
+static int bc_compile_node(struct bc_compiler *c, node *op, int ref)
+{
+	bc_insn *in, *jmp;
+	int opn;
+
+	if (!op)
+		return 0;
+
+	opn = op->info & OPNMASK;
+	if (op->info == OC_CONST || op->info == OC_VAR || op->info == OC_FNARG) {
+		in = bc_add(c, BC_VAR, 1);
+		if (!in)
+			return 0;
+		if (op->info == OC_CONST) {
+			if (!ref) {
+				in->code = BC_NUM;
+				in->u.d = getvar_i(op->l.v);
+				return 1;
+			}
+			in->u.v = op->l.v;
+		} else {
+			bc_leaf_var(op, in);
+		}
+		in->ref = ref;
+		return 1;
+	}
+
+	switch (XC(op->info & OPCLSMASK)) {
+	case XC( OC_BINARY ):
+		if (!bc_compile_node(c, op->l.n, 0)
+		 || !bc_compile_node(c, op->r.n, 0)
+		 || !(in = bc_add(c, BC_BINARY, -1))
+		) {
+			return 0;
+		}
+		in->opn = opn;
+		return 1;
+
+	case XC( OC_UNARY ):
+		switch (opn) {
+		case '+':
+			return bc_compile_node(c, op->r.n, 0);
+		case '-':
+			return bc_compile_node(c, op->r.n, 0)
+				&& bc_add(c, BC_NEG, 0);
+		case '!':
+			return bc_compile_node(c, op->r.n, 1)
+				&& bc_add(c, BC_NOT, 0);
+		}
+		in = bc_add(c, BC_INCR, 1);
+		if (!in || !bc_target(op->r.n, in))
+			return 0;
+		in->opn = opn;
+		return 1;
+
+	case XC( OC_COMPARE ):
+		if (!bc_compile_node(c, op->l.n, 1)
+		 || !bc_compile_node(c, op->r.n, 1)
+		 || !(in = bc_add(c, BC_COMPARE, -1))
+		) {
+			return 0;
+		}
+		in->opn = opn;
+		return 1;
+
+	case XC( OC_LAND ):
+	case XC( OC_LOR ):
+		if (!bc_compile_node(c, op->l.n, 1))
+			return 0;
+		jmp = bc_add(c, (op->info & OPCLSMASK) == OC_LAND ? BC_LAND : BC_LOR, -1);
+		if (!jmp
+		 || !bc_compile_node(c, op->r.n, 1)
+		 || !bc_add(c, BC_BOOL, 0)
+		) {
+			return 0;
+		}
+		jmp->arg = c->n;
+		return 1;
+
+	case XC( OC_MOVE ):
+		/* x = y copies y's string, only numeric results are for us */
+		if (!op->r.n
+		 || op->r.n->info == OC_CONST || op->r.n->info == OC_VAR || op->r.n->info == OC_FNARG
+		 || !bc_compile_node(c, op->r.n, 0)
+		 || !(in = bc_add(c, BC_MOVE, 0))
+		 || !bc_target(op->l.n, in)
+		) {
+			return 0;
+		}
+		in->ref = ref;
+		return 1;
+
+	case XC( OC_REPLACE ):
+		/* x op= y: x's value is taken before y is evaluated */
+		if (!(in = bc_add(c, BC_VAR, 1))
+		 || !bc_target(op->l.n, in)
+		 || !bc_compile_node(c, op->r.n, 0)
+		 || !(in = bc_add(c, BC_REPLACE, -1))
+		) {
+			return 0;
+		}
+		bc_target(op->l.n, in);
+		in->opn = opn;
+		in->ref = ref;
+		return 1;
+	}
+	return 0;
+}
+
+static bcode *bc_compile(node *op)
+{
+	struct bc_compiler *c;
+	bcode *bc = BC_NONE;
+
+	switch (XC(op->info & OPCLSMASK)) {
+	case XC( OC_BINARY ):
+	case XC( OC_UNARY ):
+	case XC( OC_COMPARE ):
+	case XC( OC_LAND ):
+	case XC( OC_LOR ):
+	case XC( OC_MOVE ):
+	case XC( OC_REPLACE ):
+		c = xzalloc(sizeof(*c));
+		if (bc_compile_node(c, op, 1)
+		 && c->max_depth <= BC_MAX_STACK
+		) {
+			/* bc_add() left room for BC_END (all zeros) */
+			c->n++;
+			bc = xmemdup(c->code, c->n * sizeof(c->code[0]));
+		}
+		free(c);
+	}
+	debug_printf_eval("bc_compile: %p\n", bc);
+	return bc;
+}
+
+static var *bc_run(const bcode *bc, var *res)
+{
+	struct {
+		var *v;    /* or NULL if it's a number */
+		double d;
+	} st[BC_MAX_STACK], *sp = st;
+	const bc_insn *in;
+	var *v;
+	double L_d, R_d;
+	int i;
+
+#define BC_VAL(e) ((e).v ? getvar_i((e).v) : (e).d)
+#define BC_TRUE(e) ((e).v ? istrue((e).v) : (e).d != 0)
+#define BC_VARP(in) ((in)->u.v ? (in)->u.v : &G.evaluate__fnargs[(in)->arg])
+	for (in = bc->code;; in++) {
+		switch (in->code) {
+		case BC_END:
+			if (sp[-1].v)
+				return sp[-1].v;
+			return setvar_i(res, sp[-1].d);
+
+		case BC_NUM:
+			sp->v = NULL;
+			sp->d = in->u.d;
+			sp++;
+			break;
+
+		case BC_VAR:
+			v = BC_VARP(in);
+			if (v == intvar[NF])
+				split_f0();
+			sp->v = v;
+			if (!in->ref) {
+				sp->v = NULL;
+				sp->d = getvar_i(v);
+			}
+			sp++;
+			break;
+
+		case BC_BINARY:
+		case BC_REPLACE:
+			sp--;
+			L_d = sp[-1].d;
+			R_d = sp[0].d;
+			switch (in->opn) {
+			case '+':
+				L_d += R_d;
+				break;
+			case '-':
+				L_d -= R_d;
+				break;
+			case '*':
+				L_d *= R_d;
+				break;
+			case '/':
+				if (R_d == 0)
+					syntax_error(EMSG_DIV_BY_ZERO);
+				L_d /= R_d;
+				break;
+			case '&':
+				if (ENABLE_FEATURE_AWK_LIBM)
+					L_d = pow(L_d, R_d);
+				else
+					syntax_error(EMSG_NO_MATH);
+				break;
+			case '%':
+				if (R_d == 0)
+					syntax_error(EMSG_DIV_BY_ZERO);
+				L_d -= (long long)(L_d / R_d) * R_d;
+				break;
+			}
+			sp[-1].d = L_d;
+			if (in->code == BC_REPLACE)
+				goto store;
+			break;
+
+		case BC_NEG:
+			sp[-1].d = -sp[-1].d;
+			break;
+
+		case BC_NOT:
+			sp[-1].d = !BC_TRUE(sp[-1]);
+			sp[-1].v = NULL;
+			break;
+
+		case BC_INCR:
+			v = BC_VARP(in);
+			L_d = R_d = getvar_i(v);
+			if (in->opn == 'P' || in->opn == 'p')
+				R_d++;
+			else
+				R_d--;
+			if (in->opn == 'P' || in->opn == 'M')
+				L_d = R_d;
+			setvar_i(v, R_d);
+			sp->v = NULL;
+			sp->d = L_d;
+			sp++;
+			break;
+
+		case BC_COMPARE:
+			sp--;
+			if ((!sp[-1].v || is_numeric(sp[-1].v))
+			 && (!sp[0].v || is_numeric(sp[0].v))
+			) {
+				L_d = BC_VAL(sp[-1]);
+				L_d -= BC_VAL(sp[0]);
+			} else {
+				/* a number compared to a string: as a string */
+				var *tmpvars = nvalloc(2);
+				const char *l, *r;
+
+				if (!sp[-1].v)
+					sp[-1].v = setvar_i(tmpvars, sp[-1].d);
+				if (!sp[0].v)
+					sp[0].v = setvar_i(tmpvars + 1, sp[0].d);
+				l = getvar_s(sp[-1].v);
+				r = getvar_s(sp[0].v);
+				L_d = icase ? strcasecmp(l, r) : strcmp(l, r);
+				nvfree(tmpvars, 2);
+			}
+			switch (in->opn & 0xfe) {
+			case 0:
+				i = (L_d > 0);
+				break;
+			case 2:
+				i = (L_d >= 0);
+				break;
+			default: /* 4 */
+				i = (L_d == 0);
+				break;
+			}
+			sp[-1].v = NULL;
+			sp[-1].d = (i == 0) ^ (in->opn & 1);
+			break;
+
+		case BC_LAND:
+		case BC_LOR:
+			i = BC_TRUE(sp[-1]);
+			if (i == (in->code == BC_LOR)) {
+				/* result is known, skip the right side */
+				sp[-1].v = NULL;
+				sp[-1].d = i;
+				in = &bc->code[in->arg - 1];
+				break;
+			}
+			sp--;
+			break;
+
+		case BC_BOOL:
+			sp[-1].d = BC_TRUE(sp[-1]);
+			sp[-1].v = NULL;
+			break;
+
+		case BC_MOVE:
+			L_d = sp[-1].d;
+ store:
+			v = BC_VARP(in);
+			setvar_i(v, L_d);
+			sp[-1].v = in->ref ? v : NULL;
+			sp[-1].d = L_d;
+			break;
+		}
+	}
+#undef BC_VAL
+#undef BC_TRUE
+#undef BC_VARP
+}
+#endif
+
 /*
  * Evaluate node - the heart of the program. Supplied with subtree
  * and "res" variable to assign the result to if we evaluate an expression.
  * If node refers to e.g. a variable or a field, no assignment happens.
  * Return ptr to the result (which may or may not be the "res" variable!)
  */
-#define XC(n) ((n) >> 8)
 
 static var *evaluate(node *op, var *res)
 {
@@ -3152,7 +3968,6 @@ static var *evaluate(node *op, var *res)
 #define fnargs (G.evaluate__fnargs)
 /* seed is initialized to 1 */
 #define seed   (G.evaluate__seed)
-#define sreg   (G.evaluate__sreg)
 
 	var *tmpvars;
 
@@ -3161,6 +3976,27 @@ static var *evaluate(node *op, var *res)
 
 	debug_printf_eval("entered %s()\n", __func__);
 
+	/* Plain variables and constants are the most common operands,
+	 * return them without going through the loop below */
+	switch (op->info) {
+	case OC_CONST:
+		return op->l.v;
+	case OC_VAR:
+		if (op->l.v != intvar[NF])
+			return op->l.v;
+		break;
+	case OC_FNARG:
+		return &fnargs[op->l.aidx];
+	}
+#if ENABLE_FEATURE_AWK_BYTECODE
+	if (!op->bc)
+		op->bc = bc_compile(op);
+	if (op->bc != BC_NONE) {
+		g_lineno = op->lineno;
+		return bc_run(op->bc, res);
+	}
+#endif
+
 	tmpvars = nvalloc(2);
 #define TMPVAR0 (tmpvars)
 #define TMPVAR1 (tmpvars + 1)
@@ -3194,7 +4030,13 @@ static var *evaluate(node *op, var *res)
 			L.v = evaluate(op1, TMPVAR0);
 			/* Does L.v point to $n variable? */
 			if ((size_t)(L.v - Fields) < num_alloc_fields) {
-				/* yes, remember where Fields[] is */
+				/* $n = ...: split all fields before R.v is evaluated */
+				if ((opinfo & OPCLSMASK) == OC_MOVE
+				 || (opinfo & OPCLSMASK) == OC_REPLACE
+				) {
+					L.v = field_lvalue(L.v);
+				}
+				/* remember where Fields[] is */
 				old_Fields_ptr = Fields;
 			}
 			if (opinfo & OF_NUM1) {
@@ -3425,10 +4267,7 @@ static var *evaluate(node *op, var *res)
 			op1 = op->r.n;
  re_cont:
 			{
-				regex_t *re = as_regex(op1, &sreg);
-				int i = regexec(re, L.s, 0, NULL, 0);
-				if (re == &sreg)
-					regfree(re);
+				int i = regexec(as_regex(op1), L.s, 0, NULL, 0);
 				setvar_i(res, (i == 0) ^ (opn == '!'));
 			}
 			break;
@@ -3440,7 +4279,7 @@ static var *evaluate(node *op, var *res)
 				L.v = res;
 			/* if source is a temporary string, just relink it to dest */
 			if (R.v == TMPVAR1
-			 && !(R.v->type & VF_NUMBER)
+			 && !(R.v->type & (VF_NUMBER | VF_FSTR))
 				/* Why check !NUMBER? if R.v is a number but has cached R.v->string,
 				 * L.v ends up a string, which is wrong */
 			 /*&& R.v->string - always not NULL (right?) */
@@ -3538,7 +4377,7 @@ static var *evaluate(node *op, var *res)
 			if (!op->r.n)
 				R.v = intvar[F0];
 
-			i = awk_getline(rsm, R.v);
+			i = awk_getline(rsm, field_lvalue(R.v));
 			if (i > 0 && !op1) {
 				incvar(intvar[FNR]);
 				incvar(intvar[NR]);
@@ -3728,7 +4567,7 @@ static var *evaluate(node *op, var *res)
 			case 'm':
 				R_d--;
  r_op_change:
-				setvar_i(R.v, R_d);
+				setvar_i(field_lvalue(R.v), R_d);
 				break;
 			case '!':
 				Ld = !istrue(R.v);
@@ -3750,7 +4589,7 @@ static var *evaluate(node *op, var *res)
 			if (i == 0) {
 				res = intvar[F0];
 			} else {
-				split_f0();
+				split_f0_upto(i);
 				if (i > num_fields)
 					fsrealloc(i);
 				res = &Fields[i - 1];
@@ -3867,12 +4706,11 @@ static var *evaluate(node *op, var *res)
 	return res;
 #undef fnargs
 #undef seed
-#undef sreg
 }
 
 static int awk_exit(void)
 {
-	unsigned i;
+	hash_item *hi;
 
 	if (!exiting) {
 		exiting = TRUE;
@@ -3881,14 +4719,9 @@ static int awk_exit(void)
 	}
 
 	/* waiting for children */
-	for (i = 0; i < fdhash->csize; i++) {
-		hash_item *hi;
-		hi = fdhash->items[i];
-		while (hi) {
-			if (hi->data.rs.F && hi->data.rs.is_pipe)
-				pclose(hi->data.rs.F);
-			hi = hi->next;
-		}
+	for (hi = fdhash->first; hi; hi = hi->next) {
+		if (hi->data.rs.F && hi->data.rs.is_pipe)
+			pclose(hi->data.rs.F);
 	}
 
 	exit(G.exitcode);
@@ -3951,7 +4784,7 @@ int awk_main(int argc UNUSED_PARAM, char **argv)
 	ahash = hash_init();
 
 	/* Cannot use getopt32: need to preserve order of -e / -f / -E / -i */
-	while ((ch = getopt(argc, argv, OPTSTR_AWK)) >= 0) {
+	while ((ch = awk_getopt(argc, argv)) >= 0) {
 		switch (ch) {
 		case 'F':
 			unescape_string_in_place(optarg);
@@ -3990,6 +4823,9 @@ int awk_main(int argc UNUSED_PARAM, char **argv)
 			parse_program(optarg);
 			got_program = 1;
 			break;
+		case 'k':
+			csv_mode = 1;
+			break;
 #endif
 		case 'W':
 			bb_simple_error_msg("warning: option -W is ignored");
@@ -4012,11 +4848,9 @@ int awk_main(int argc UNUSED_PARAM, char **argv)
 	}
 
 	/* Free unused parse structures */
-	//hash_free(fnhash); // ~250 bytes when empty, used only for function names
-	//^^^^^^^^^^^^^^^^^ does not work, hash_clear() inside SEGVs
-	// (IOW: hash_clear() assumes it's a hash of variables. fnhash is not).
-	free(fnhash->items);
-	free(fnhash);
+	/* Function names are used only in parsing stage
+	 * (the functions themselves stay in use) */
+	hash_free(fnhash);
 	fnhash = NULL; // debug
 	//hash_free(ahash); // empty after parsing, will reuse as fdhash instead of freeing
 
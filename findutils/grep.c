@@ -43,6 +43,34 @@
 //config:	Print the specified number of leading (-B) and/or trailing (-A)
 //config:	context surrounding our matching lines.
 //config:	Print the specified number of context lines (-C).
+//config:
+//config:config FEATURE_GREP_FAST_F
+//config:	bool "Fast search for many fixed strings (-F -f FILE)"
+//config:	default y
+//config:	depends on GREP || EGREP || FGREP
+//config:	help
+//config:	With -F and several patterns, find all of them in one pass
+//config:	over each line (Aho-Corasick automaton) instead of searching
+//config:	for every pattern separately. Useful with thousands of patterns.
+//config:
+//config:config FEATURE_GREP_PREFILTER
+//config:	bool "Skip lines without a literal string required by the regex"
+//config:	default y
+//config:	depends on GREP || EGREP || FGREP
+//config:	help
+//config:	Find the longest fixed string every match of a regex must
+//config:	contain (e.g. "error: " in "error: .*timeout") and run the
+//config:	regex engine only on lines containing it. Makes searching
+//config:	large files where few lines match several times faster.
+//config:
+//config:config FEATURE_GREP_PARALLEL
+//config:	bool "Search directory trees using several processes (-j N)"
+//config:	default y
+//config:	depends on (GREP || EGREP || FGREP) && PLATFORM_POSIX && !NOMMU
+//config:	help
+//config:	With -r and -j N, files are searched by N child processes,
+//config:	which hides open/read latency on big trees. Output is the same
+//config:	as without -j.
 
 //applet:IF_GREP(APPLET(grep, BB_DIR_BIN, BB_SUID_DROP))
 //                APPLET_ODDNAME:name   main  location    suid_type     help
@@ -61,6 +89,7 @@
 //usage:       "[-HhnlLoqvsrRiwFE"
 //usage:	IF_EXTRA_COMPAT("z")
 //usage:       "] [-m N] "
+//usage:	IF_FEATURE_GREP_PARALLEL("[-j N] ")
 //usage:	IF_FEATURE_GREP_CONTEXT("[-A|B|C N] ")
 //usage:       "{ PATTERN | -e PATTERN... | -f FILE... } [FILE]..."
 //usage:#define grep_full_usage "\n\n"
@@ -77,6 +106,9 @@
 //usage:     "\n	-s	Suppress open and read errors"
 //usage:     "\n	-r	Recurse"
 //usage:     "\n	-R	Recurse and dereference symlinks"
+//usage:	IF_FEATURE_GREP_PARALLEL(
+//usage:     "\n	-j N	Search files with N processes (with -r)"
+//usage:	)
 //usage:     "\n	-i	Ignore case"
 //usage:     "\n	-w	Match whole words only"
 //usage:     "\n	-x	Match whole lines only"
@@ -111,6 +143,7 @@
 	IF_FEATURE_GREP_CONTEXT("A:+B:+C:+") \
 	"E" \
 	IF_EXTRA_COMPAT("z") \
+	IF_FEATURE_GREP_PARALLEL("j:+") \
 	"aI"
 /* ignored: -a "assume all files to be text" */
 /* ignored: -I "assume binary files have no matches" */
@@ -139,6 +172,7 @@ enum {
 	IF_FEATURE_GREP_CONTEXT(    OPTBIT_C ,) /* -C NUM: -A and -B combined */
 	OPTBIT_E, /* extended regexp */
 	IF_EXTRA_COMPAT(            OPTBIT_z ,) /* input is NUL terminated */
+	IF_FEATURE_GREP_PARALLEL(   OPTBIT_j ,) /* -j NUM: search with NUM processes */
 	OPT_l = 1 << OPTBIT_l,
 	OPT_n = 1 << OPTBIT_n,
 	OPT_q = 1 << OPTBIT_q,
@@ -163,6 +197,7 @@ enum {
 	OPT_C = IF_FEATURE_GREP_CONTEXT(    (1 << OPTBIT_C)) + 0,
 	OPT_E = 1 << OPTBIT_E,
 	OPT_z = IF_EXTRA_COMPAT(            (1 << OPTBIT_z)) + 0,
+	OPT_j = IF_FEATURE_GREP_PARALLEL(   (1 << OPTBIT_j)) + 0,
 };
 
 #define PRINT_LINE_NUM              (option_mask32 & OPT_n)
@@ -193,6 +228,16 @@ struct globals {
 	/* globals used internally */
 	llist_t *pattern_head;   /* growable list of patterns to match */
 	const char *cur_file;    /* the current file we are reading */
+	char *rbuf;              /* input buffer, see next_line() */
+	size_t rbuf_size;
+#if ENABLE_FEATURE_GREP_PARALLEL
+	unsigned jobs;           /* -j N */
+	unsigned nfiles;
+	char **files;            /* files found by grep -r -j */
+#endif
+#if ENABLE_FEATURE_GREP_FAST_F
+	struct fgrep_ac *ac;     /* all -F patterns, if there are many */
+#endif
 } FIX_ALIASING;
 #define G (*(struct globals*)bb_common_bufsiz1)
 #define INIT_G() do { \
@@ -240,6 +285,9 @@ typedef struct grep_list_data_t {
 #define ALLOCATED 1
 #define COMPILED 2
 	int flg_mem_allocated_compiled;
+#if ENABLE_FEATURE_GREP_PREFILTER
+	char *literal;  /* every match contains it, or NULL */
+#endif
 } grep_list_data_t;
 
 #if !ENABLE_EXTRA_COMPAT
@@ -278,25 +326,455 @@ static void print_line(const char *line, size_t line_len, int linenum, char deco
 	}
 }
 
-#if ENABLE_EXTRA_COMPAT
-/* Unlike getline, this one removes trailing '\n' */
-static ssize_t FAST_FUNC bb_getline(char **line_ptr, size_t *line_alloc_len, FILE *file)
+#if ENABLE_FEATURE_GREP_FAST_F
+/* Aho-Corasick automaton of -F patterns. States are numbered in BFS
+ * order, so children of a state are consecutive and their edge chars
+ * can be searched with memchr. State 0 is the root.
+ */
+#define AC_MIN_PATTERNS 48
+
+struct fgrep_ac {
+	struct ac_state {
+		unsigned first;  /* first child */
+		unsigned nchild;
+		unsigned fail;   /* longest proper suffix which is a state */
+		unsigned dict;   /* longest proper suffix which ends a pattern */
+		unsigned pat;    /* 1 + index of pattern which ends here, or 0 */
+	} *st;
+	unsigned char *ch;       /* ch[i]: edge char into state i */
+	grep_list_data_t **gl;   /* patterns in pattern_head order */
+	unsigned *len;
+	unsigned root_next[256];
+};
+
+/* Temporary trie used while adding patterns */
+struct ac_trie {
+	unsigned child, sibling, pat;
+	unsigned char ch;
+};
+
+static unsigned ac_child(struct fgrep_ac *ac, unsigned s, unsigned char c)
+{
+	unsigned first = ac->st[s].first;
+	const unsigned char *p;
+
+	/* Deep in the trie most states have one child */
+	if (ac->st[s].nchild == 1)
+		return ac->ch[first] == c ? first : 0;
+	p = memchr(ac->ch + first, c, ac->st[s].nchild);
+	return p ? p - ac->ch : 0;
+}
+
+static void build_ac(void)
+{
+	struct fgrep_ac *ac;
+	struct ac_trie *t;
+	llist_t *l;
+	unsigned *order;
+	unsigned npat, nt, n, head, i;
+
+	npat = 0;
+	nt = 1;
+	for (l = pattern_head; l; l = l->link) {
+		grep_list_data_t *gl = (grep_list_data_t *)l->data;
+		/* Empty pattern matches everywhere, -w/-x make it tricky */
+		if (!gl->pattern[0])
+			return;
+		npat++;
+		nt += strlen(gl->pattern);
+	}
+	if (npat < AC_MIN_PATTERNS)
+		return;
+
+	ac = xzalloc(sizeof(*ac));
+	ac->gl = xmalloc(npat * sizeof(ac->gl[0]));
+	ac->len = xmalloc(npat * sizeof(ac->len[0]));
+	t = xzalloc(nt * sizeof(t[0]));
+	nt = 1;
+	for (i = 0, l = pattern_head; l; i++, l = l->link) {
+		grep_list_data_t *gl = (grep_list_data_t *)l->data;
+		const char *p = gl->pattern;
+		unsigned cur = 0;
+
+		ac->gl[i] = gl;
+		ac->len[i] = strlen(p);
+		for (; *p; p++) {
+			unsigned char c = *p;
+			unsigned *pp;
+
+			if (option_mask32 & OPT_i)
+				c = tolower(c);
+			/* children are kept sorted by char */
+			for (pp = &t[cur].child; *pp && t[*pp].ch < c; pp = &t[*pp].sibling)
+				continue;
+			if (!*pp || t[*pp].ch != c) {
+				t[nt].ch = c;
+				t[nt].sibling = *pp;
+				*pp = nt++;
+			}
+			cur = *pp;
+		}
+		/* Duplicate pattern: the first one is reported by -o */
+		if (!t[cur].pat)
+			t[cur].pat = i + 1;
+	}
+
+	/* Renumber in BFS order, compute failure links on the way */
+	ac->st = xzalloc(nt * sizeof(ac->st[0]));
+	ac->ch = xmalloc(nt);
+	order = xmalloc(nt * sizeof(order[0]));
+	order[0] = 0;
+	n = 1;
+	for (head = 0; head < nt; head++) {
+		struct ac_state *s = &ac->st[head];
+		unsigned c;
+
+		s->pat = t[order[head]].pat;
+		s->first = n;
+		for (c = t[order[head]].child; c; c = t[c].sibling) {
+			unsigned f, v = n;
+
+			order[n] = c;
+			ac->ch[n++] = t[c].ch;
+			s->nchild++;
+			if (head == 0)
+				continue; /* depth 1: fail and dict are root */
+			/* Longest proper suffix of v: extend suffix of parent */
+			f = s->fail;
+			for (;;) {
+				unsigned k = ac_child(ac, f, t[c].ch);
+				if (k) {
+					ac->st[v].fail = k;
+					break;
+				}
+				if (f == 0)
+					break;
+				f = ac->st[f].fail;
+			}
+		}
+		/* fail < head, so its dict is already known */
+		if (head != 0)
+			s->dict = ac->st[s->fail].pat ? s->fail : ac->st[s->fail].dict;
+	}
+	for (i = 0; i < 256; i++)
+		ac->root_next[i] = ac_child(ac, 0, i);
+	free(order);
+	free(t);
+	G.ac = ac;
+}
+
+/* Returns the pattern found in line (with -o, the first one in
+ * pattern_head order, as the per-pattern loop would), or NULL */
+static grep_list_data_t *ac_search(const char *line)
 {
-	ssize_t res_sz;
+	struct fgrep_ac *ac = G.ac;
+	const unsigned char *p = (const unsigned char *)line;
+	unsigned best = UINT_MAX;
+	unsigned s = 0;
+
+	for (; *p; p++) {
+		unsigned c = *p;
+		unsigned o;
+
+		if (option_mask32 & OPT_i)
+			c = tolower(c);
+		for (;;) {
+			unsigned k;
+			if (s == 0) {
+				s = ac->root_next[c];
+				break;
+			}
+			k = ac_child(ac, s, c);
+			if (k) {
+				s = k;
+				break;
+			}
+			s = ac->st[s].fail;
+		}
+		/* Every pattern which ends at p */
+		for (o = ac->st[s].pat ? s : ac->st[s].dict; o; o = ac->st[o].dict) {
+			unsigned i = ac->st[o].pat - 1;
+			const char *start = (const char *)p + 1 - ac->len[i];
+
+			if (option_mask32 & OPT_x) {
+				if (start != line || p[1] != '\0')
+					continue;
+			} else
+			if (option_mask32 & OPT_w) {
+				char b = (start != line) ? start[-1] : ' ';
+				char e = p[1];
+				if (isalnum(b) || b == '_' || isalnum(e) || e == '_')
+					continue;
+			}
+			if (!(option_mask32 & OPT_o))
+				return ac->gl[i];
+			if (i < best)
+				best = i;
+		}
+	}
+	return best != UINT_MAX ? ac->gl[best] : NULL;
+}
+#endif
+
+/* Input is read in big blocks and split into lines in place,
+ * so most lines are never copied or malloced.
+ */
+#define GREP_BUFSIZE (64 * 1024)
+
+struct grep_input {
+	char *pos;       /* start of next line */
+	char *end;       /* end of data in G.rbuf */
+	size_t scanned;  /* bytes after pos known to have no delimiter */
+	int fd;
+	smallint eof;
+	IF_PLATFORM_MINGW32(smallint console;)
+	/* If set, only lines containing it can match: skip others */
+	const char *skip;
+	size_t skip_len;
+};
+
+static void fill_input(struct grep_input *in)
+{
+	size_t have = in->end - in->pos;
+	ssize_t n;
+
+	if (in->pos != G.rbuf) {
+		memmove(G.rbuf, in->pos, have);
+	} else if (have + 1 >= G.rbuf_size) {
+		/* Line longer than the buffer */
+		G.rbuf_size *= 2;
+		G.rbuf = xrealloc(G.rbuf, G.rbuf_size);
+	}
+	in->pos = G.rbuf;
+	/* Keep a byte to NUL-terminate the last line */
+	n = safe_read(in->fd, G.rbuf + have, G.rbuf_size - 1 - have);
+	/* Read errors (e.g. EISDIR) end the file silently, as getc did */
+	if (n <= 0) {
+		in->eof = 1;
+		n = 0;
+	}
+#if ENABLE_PLATFORM_MINGW32
+	if (in->console)
+		conToCharBuffA(G.rbuf + have, n);
+#endif
+	in->end = G.rbuf + have + n;
+}
+
+/* Returns next line with its delimiter replaced by NUL, or NULL at EOF.
+ * The line stays valid (and writable) until the next call.
+ */
+static char *next_line(struct grep_input *in, size_t *line_len)
+{
+	int delim = NUL_DELIMITED ? '\0' : '\n';
 	char *line;
-	int delim = (NUL_DELIMITED ? '\0' : '\n');
+	char *eol;
+
+	for (;;) {
+		line = in->pos;
+		if (in->skip && in->scanned == 0) {
+			char *p = memmem(line, in->end - line, in->skip, in->skip_len);
+			if (p) {
+				/* Jump to the start of the line containing it */
+				line = memrchr(line, delim, p - line);
+				in->pos = line = (line ? line + 1 : in->pos);
+			} else {
+				if (in->eof)
+					return NULL;
+				/* Only the last, partial line may still match */
+				line = memrchr(line, delim, in->end - line);
+				if (line)
+					in->pos = line + 1;
+				fill_input(in);
+				continue;
+			}
+		}
+		eol = memchr(line + in->scanned, delim, in->end - line - in->scanned);
+		if (eol)
+			break;
+		if (in->eof) {
+			if (line == in->end)
+				return NULL;
+			eol = in->end; /* last line has no delimiter */
+			break;
+		}
+		in->scanned = in->end - line;
+		fill_input(in);
+	}
+	in->scanned = 0;
+	*eol = '\0';
+	in->pos = eol + (eol != in->end);
+#if !ENABLE_EXTRA_COMPAT
+	{
+		/* A NUL ends a line too, like bb_get_chunk_from_file() does */
+		size_t len = strlen(line);
+		if (line + len != eol) {
+			in->pos = line + len + 1;
+			eol = line + len;
+		}
+# if ENABLE_PLATFORM_MINGW32
+		else if (eol != line && eol[-1] == '\r' && eol != in->end) {
+			*--eol = '\0';
+		}
+# endif
+	}
+#endif
+	*line_len = eol - line;
+	return line;
+}
+
+#if ENABLE_FEATURE_GREP_PREFILTER
+/* Find the longest string which every match of regex PAT contains.
+ * Lines without it are rejected without running the regex engine.
+ * This only needs to be safe, not clever: anything not understood
+ * ends the current run of literal chars, or gives up altogether.
+ */
+static char *regex_literal(const char *p)
+{
+	char *run, *best;
+	unsigned len, best_len;
+	int depth;
+	smallint ere = ((option_mask32 & OPT_E) != 0);
+	smallint icase = ((option_mask32 & OPT_i) != 0);
+
+	/* Multibyte case folding isn't byte-wise (e.g. KELVIN SIGN vs 'k') */
+	if (icase && MB_CUR_MAX > 1)
+		return NULL;
+
+	len = strlen(p) + 1;
+	run = xmalloc(len);
+	best = xmalloc(len);
+	best_len = len = 0;
+	depth = 0;
+	for (;;) {
+		unsigned char c = *p++;
+		smallint special;
+
+		if (c == '\\') {
+			c = *p++;
+			if (c == '\0')
+				goto fail;
+			/* \w, \b, \<, \1...: not a literal char */
+			special = (isalnum(c) || strchr("<>`'", c));
+			if (special)
+				c = '.';
+			else if (!ere)
+				special = (strchr("(){}|+?", c) != NULL);
+		} else {
+			if (c == '\0')
+				break;
+			special = (strchr(ere ? ".[^$*(){}|+?" : ".[^$*", c) != NULL);
+		}
+		/* With -i, non-ASCII bytes may match differently cased ones */
+		if (c >= 0x80 && icase) {
+			special = 1;
+			c = '.';
+		}
+		if (!special) {
+			if (depth == 0)
+				run[len++] = c;
+			continue;
+		}
+
+		switch (c) {
+		case '[':
+			if (*p == '^')
+				p++;
+			if (*p == ']')
+				p++;
+			while (*p != ']') {
+				if (*p == '\0')
+					goto fail;
+				if (*p == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+					char *e = strchr(p + 2, p[1]);
+					if (!e || e[1] != ']')
+						goto fail;
+					p = e + 1;
+				}
+				p++;
+			}
+			p++;
+			break;
+		case '(':
+			depth++;
+			break;
+		case ')':
+			if (depth == 0)
+				goto fail;
+			depth--;
+			break;
+		case '|':
+			/* Alternatives inside a group don't matter at depth 0 */
+			if (depth == 0)
+				goto fail;
+			break;
+		case '}':
+			goto fail;
+		case '{':
+			/* Only a well-formed interval: {N}, {N,}, {,M}, {N,M} */
+			p += strspn(p, "0123456789");
+			if (*p == ',')
+				p += 1 + strspn(p + 1, "0123456789");
+			if (!ere && *p++ != '\\')
+				goto fail;
+			if (*p++ != '}')
+				goto fail;
+			/* fall through */
+		case '*':
+		case '?':
+		case '+':
+			/* The preceding char may be absent (or, for +, the run
+			 * ends after it). Drop it, whole if it is multibyte.
+			 * A prefix of a required string is still required.
+			 */
+			while (len != 0 && (run[--len] & 0xc0) == 0x80)
+				continue;
+			break;
+		}
+		/* '.', '^', '$', anything special: end of run */
+		if (len > best_len) {
+			memcpy(best, run, len);
+			best_len = len;
+		}
+		len = 0;
+	}
+	if (len > best_len) {
+		memcpy(best, run, len);
+		best_len = len;
+	}
+	free(run);
+	if (best_len != 0) {
+		best[best_len] = '\0';
+		return best;
+	}
+	free(best);
+	return NULL;
+ fail:
+	free(run);
+	free(best);
+	return NULL;
+}
 
-	res_sz = getdelim(line_ptr, line_alloc_len, delim, file);
-	line = *line_ptr;
+# if !ENABLE_EXTRA_COMPAT
+/* regexec stops at NUL too, so str[case]str is exact here */
+#  define line_has_literal(line, line_len, lit) \
+	((option_mask32 & OPT_i) ? strcasestr(line, lit) : strstr(line, lit))
+# else
+static int line_has_literal(const char *line, size_t line_len, const char *lit)
+{
+	const char *end = line + line_len;
 
-	if (res_sz > 0) {
-		if (line[res_sz - 1] == delim)
-			line[--res_sz] = '\0';
-	} else {
-		free(line); /* uclibc allocates a buffer even on EOF. WTF? */
+	if (!(option_mask32 & OPT_i))
+		return memmem(line, line_len, lit, strlen(lit)) != NULL;
+	/* The line may contain NULs: search each NUL-terminated piece */
+	for (;;) {
+		if (strcasestr(line, lit))
+			return 1;
+		line += strlen(line) + 1;
+		if (line >= end)
+			return 0;
 	}
-	return res_sz;
 }
+# endif
 #endif
 
 static int grep_file(FILE *file)
@@ -304,12 +782,10 @@ static int grep_file(FILE *file)
 	smalluint found;
 	int linenum = 0;
 	int nmatches = 0;
-#if !ENABLE_EXTRA_COMPAT
 	char *line;
-#else
-	char *line = NULL;
-	ssize_t line_len;
-	size_t line_alloc_len;
+	size_t line_len;
+	struct grep_input in;
+#if ENABLE_EXTRA_COMPAT
 # define rm_so start[0]
 # define rm_eo end[0]
 #endif
@@ -321,18 +797,51 @@ static int grep_file(FILE *file)
 	enum { print_n_lines_after = 0 };
 #endif
 
-	while (
-#if !ENABLE_EXTRA_COMPAT
-		(line = xmalloc_fgetline(file)) != NULL
-#else
-		(line_len = bb_getline(&line, &line_alloc_len, file)) >= 0
+	if (!G.rbuf) {
+		G.rbuf_size = GREP_BUFSIZE;
+		G.rbuf = xmalloc(GREP_BUFSIZE);
+	}
+	memset(&in, 0, sizeof(in));
+	in.pos = in.end = G.rbuf;
+	in.fd = fileno(file);
+#if ENABLE_PLATFORM_MINGW32
+	in.console = (isatty(in.fd) &&
+			GetStdHandle(STD_INPUT_HANDLE) != INVALID_HANDLE_VALUE);
 #endif
+	/* With a single pattern, lines without its fixed string can be
+	 * skipped wholesale, unless they are needed for -v, -n or context.
+	 */
+	if (!pattern_head->link
+	 && !(option_mask32 & (OPT_v|OPT_n|OPT_i))
+	 IF_FEATURE_GREP_CONTEXT(&& !lines_before && !lines_after)
 	) {
+		grep_list_data_t *gl = (grep_list_data_t *)pattern_head->data;
+		if (FGREP_FLAG)
+			in.skip = gl->pattern;
+#if ENABLE_FEATURE_GREP_PREFILTER
+		else
+			in.skip = gl->literal;
+#endif
+		if (in.skip) {
+			in.skip_len = strlen(in.skip);
+			if (in.skip_len == 0)
+				in.skip = NULL;
+		}
+	}
+
+	while ((line = next_line(&in, &line_len)) != NULL) {
 		llist_t *pattern_ptr = pattern_head;
 		grep_list_data_t *gl = gl; /* for gcc */
 
 		linenum++;
 		found = 0;
+#if ENABLE_FEATURE_GREP_FAST_F
+		if (G.ac) {
+			gl = ac_search(line);
+			found = (gl != NULL);
+			pattern_ptr = NULL;
+		}
+#endif
 		while (pattern_ptr) {
 			gl = (grep_list_data_t *)pattern_ptr->data;
 			if (FGREP_FLAG) {
@@ -372,23 +881,16 @@ static int grep_file(FILE *file)
 #endif
 				char *match_at;
 
-				if (!(gl->flg_mem_allocated_compiled & COMPILED)) {
-					gl->flg_mem_allocated_compiled |= COMPILED;
-#if !ENABLE_EXTRA_COMPAT
-					xregcomp(&gl->compiled_regex, gl->pattern, reflags);
-#else
-					memset(&gl->compiled_regex, 0, sizeof(gl->compiled_regex));
-					gl->compiled_regex.translate = case_fold; /* for -i */
-					if (re_compile_pattern(gl->pattern, strlen(gl->pattern), &gl->compiled_regex))
-						bb_error_msg_and_die("bad regex '%s'", gl->pattern);
-#endif
-				}
 #if !ENABLE_EXTRA_COMPAT
 				gl->matched_range.rm_so = 0;
 				gl->matched_range.rm_eo = 0;
 				match_flg = 0;
 #else
 				start_pos = 0;
+#endif
+#if ENABLE_FEATURE_GREP_PREFILTER
+				if (gl->literal && !line_has_literal(line, line_len, gl->literal))
+					goto opt_re_not_found;
 #endif
 				match_at = line;
  opt_w_again:
@@ -441,6 +943,9 @@ static int grep_file(FILE *file)
 						}
 					}
 				}
+#if ENABLE_FEATURE_GREP_PREFILTER
+ opt_re_not_found: ;
+#endif
 			}
 			/* If it's a non-inverted search, we can stop
 			 * at first match and report it.
@@ -464,7 +969,6 @@ static int grep_file(FILE *file)
 
 			/* quiet/print (non)matching file names only? */
 			if (option_mask32 & (OPT_q|OPT_l|OPT_L)) {
-				free(line); /* we don't need line anymore */
 				if (BE_QUIET) {
 					/* manpage says about -q:
 					 * "exit immediately with zero status
@@ -567,18 +1071,13 @@ static int grep_file(FILE *file)
 			} else if (lines_before) {
 				/* Add the line to the circular 'before' buffer */
 				free(before_buf[curpos]);
-				before_buf[curpos] = line;
+				before_buf[curpos] = xmemdup(line, line_len + 1);
 				IF_EXTRA_COMPAT(before_buf_size[curpos] = line_len;)
 				curpos = (curpos + 1) % lines_before;
-				/* avoid free(line) - we took the line */
-				line = NULL;
 			}
 		}
 
 #endif /* ENABLE_FEATURE_GREP_CONTEXT */
-#if !ENABLE_EXTRA_COMPAT
-		free(line);
-#endif
 		/* Did we print all context after last requested match? */
 		if ((option_mask32 & OPT_m)
 		 && !print_n_lines_after
@@ -654,11 +1153,29 @@ static void load_pattern_list(llist_t **lst, char *pattern)
 		llist_add_to(lst, new_grep_list_data(p, 0));
 }
 
+static int grep_filename(const char *filename)
+{
+	FILE *file;
+	int matched;
+
+	file = fopen_for_read(filename);
+	if (file == NULL) {
+		if (!SUPPRESS_ERR_MSGS)
+			bb_simple_perror_msg(filename);
+		open_errors = 1;
+		return -1;
+	}
+	cur_file = filename;
+	matched = grep_file(file);
+	fclose(file);
+	return matched;
+}
+
 static int FAST_FUNC file_action_grep(struct recursive_state *state UNUSED_PARAM,
 		const char *filename,
 		struct stat *statbuf)
 {
-	FILE *file;
+	int matched;
 
 	/* If we are given a link to a directory, we should bail out now, rather
 	 * than trying to open the "file" and hoping getline gives us nothing,
@@ -675,19 +1192,175 @@ static int FAST_FUNC file_action_grep(struct recursive_state *state UNUSED_PARAM
 			return 1;
 	}
 
-	file = fopen_for_read(filename);
-	if (file == NULL) {
-		if (!SUPPRESS_ERR_MSGS)
-			bb_simple_perror_msg(filename);
-		open_errors = 1;
-		return 0;
+#if ENABLE_FEATURE_GREP_PARALLEL
+	if (G.jobs > 1) {
+		/* Just collect names, grep_parallel() does the rest */
+		G.files = xrealloc_vector(G.files, 8, G.nfiles);
+		G.files[G.nfiles++] = xstrdup(filename);
+		return 1;
 	}
-	cur_file = filename;
-	*(int*)state->userData |= grep_file(file);
-	fclose(file);
+#endif
+	matched = grep_filename(filename);
+	if (matched < 0)
+		return 0;
+	*(int*)state->userData |= matched;
 	return 1;
 }
 
+#if ENABLE_FEATURE_GREP_PARALLEL
+/* Files found by the tree walk are split into chunks of consecutive
+ * files, each searched by a child process. Up to G.jobs children run
+ * at once. Output of a chunk is copied to stdout when its turn comes,
+ * and read into memory until then, so it comes out in walk order.
+ */
+#define GREP_CHUNK_MIN 8
+#define GREP_CHUNK_MAX 256
+#define GREP_AHEAD 4   /* chunks started ahead of output, per job */
+
+struct grep_chunk {
+	pid_t pid;
+	int fd;          /* -1 when all output is read */
+	char *out;       /* output read before its turn */
+	size_t len;
+};
+
+static void start_chunk(struct grep_chunk *c, struct grep_chunk *cur,
+		unsigned first, unsigned last)
+{
+	struct fd_pair pipe;
+
+	xpiped_pair(pipe);
+	c->pid = xfork();
+	if (c->pid == 0) {
+		int matched = 0;
+
+		/* Other children's pipes are not ours */
+		for (; cur != c; cur++)
+			if (cur->fd >= 0)
+				close(cur->fd);
+		close(pipe.rd);
+		xmove_fd(pipe.wr, STDOUT_FILENO);
+		while (first < last)
+			matched |= (grep_filename(G.files[first++]) > 0);
+		/* -q exits with 0 on a match, like this */
+		fflush_all();
+		_exit((!matched) | (open_errors << 2));
+	}
+	close(pipe.wr);
+	c->fd = pipe.rd;
+	c->out = NULL;
+	c->len = 0;
+}
+
+static int grep_parallel(void)
+{
+	struct grep_chunk *chunk;
+	struct pollfd *pfd;
+	char *buf;
+	unsigned jobs, per, nchunks, cur, next, running;
+	int matched = 0;
+
+	/* More jobs than files would only sit idle (and overflow below).
+	 * Not in G.jobs: the next directory operand may have more files */
+	jobs = MIN(G.jobs, G.nfiles);
+	per = G.nfiles / (jobs * GREP_AHEAD * 2);
+	per = MAX(per, GREP_CHUNK_MIN);
+	per = MIN(per, GREP_CHUNK_MAX);
+	nchunks = (G.nfiles + per - 1) / per;
+	chunk = xzalloc(nchunks * sizeof(chunk[0]));
+	/* No more than this many chunks are between cur and next */
+	pfd = xmalloc(MIN(nchunks, jobs * GREP_AHEAD) * sizeof(pfd[0]));
+	buf = xmalloc(GREP_BUFSIZE);
+
+	/* Children must not write out our buffered data */
+	fflush_all();
+	cur = next = running = 0;
+	while (cur < nchunks) {
+		unsigned i, n;
+
+		while (running < jobs && next < nchunks
+		 && next < cur + jobs * GREP_AHEAD
+		) {
+			start_chunk(&chunk[next], &chunk[cur],
+				next * per, MIN((next + 1) * per, G.nfiles));
+			next++;
+			running++;
+		}
+
+		n = 0;
+		for (i = cur; i < next; i++) {
+			if (chunk[i].fd >= 0) {
+				pfd[n].fd = chunk[i].fd;
+				pfd[n].events = POLLIN;
+				n++;
+			}
+		}
+		if (safe_poll(pfd, n, -1) < 0)
+			bb_simple_perror_msg_and_die("poll");
+
+		n = 0;
+		for (i = cur; i < next; i++) {
+			struct grep_chunk *c = &chunk[i];
+			ssize_t r;
+			int status;
+
+			if (c->fd < 0)
+				continue;
+			if (!pfd[n++].revents)
+				continue;
+			r = safe_read(c->fd, buf, GREP_BUFSIZE);
+			if (r > 0) {
+				/* Output of the current chunk goes straight out */
+				if (i == cur) {
+					xwrite(STDOUT_FILENO, buf, r);
+				} else {
+					c->out = xrealloc(c->out, c->len + r);
+					memcpy(c->out + c->len, buf, r);
+					c->len += r;
+				}
+				continue;
+			}
+			close(c->fd);
+			c->fd = -1;
+			running--;
+			if (safe_waitpid(c->pid, &status, 0) < 0
+			 || !WIFEXITED(status) || (WEXITSTATUS(status) & ~5)
+			) {
+				open_errors = 1;
+				continue;
+			}
+			status = WEXITSTATUS(status);
+			if (!(status & 1)) {
+				if (BE_QUIET) {
+					/* Stop the others, they'd only be waited for */
+					for (i = cur; i < next; i++)
+						if (chunk[i].fd >= 0)
+							kill(chunk[i].pid, SIGKILL);
+					exit_SUCCESS();
+				}
+				matched = 1;
+			}
+			if (status & 4)
+				open_errors = 1;
+		}
+
+		/* Next chunk's turn: write out what it has so far */
+		while (cur < next && chunk[cur].fd < 0) {
+			cur++;
+			if (cur < next) {
+				xwrite(STDOUT_FILENO, chunk[cur].out, chunk[cur].len);
+				free(chunk[cur].out);
+				chunk[cur].out = NULL;
+			}
+		}
+	}
+	free(buf);
+	free(pfd);
+	free(chunk);
+	return matched;
+}
+#endif
+
 static int grep_dir(const char *dir)
 {
 	int matched = 0;
@@ -701,6 +1374,13 @@ static int grep_dir(const char *dir)
 		/* dirAction= */ NULL,
 		/* userData= */ &matched
 	);
+#if ENABLE_FEATURE_GREP_PARALLEL
+	if (G.nfiles) {
+		matched = grep_parallel();
+		while (G.nfiles)
+			free(G.files[--G.nfiles]);
+	}
+#endif
 	return matched;
 }
 
@@ -728,6 +1408,7 @@ int grep_main(int argc UNUSED_PARAM, char **argv)
 		"color\0" Optional_argument "\xff",
 		&pattern_head, &fopt, &max_matches,
 		&lines_after, &lines_before, &Copt
+		IF_FEATURE_GREP_PARALLEL(, &G.jobs)
 		, NULL
 	);
 
@@ -754,7 +1435,13 @@ int grep_main(int argc UNUSED_PARAM, char **argv)
 #else
 	/* with auto sanity checks */
 	getopt32(argv, "^" OPTSTR_GREP "\0" "H-h:c-n:q-n:l-n:", // why trailing ":"?
-		&pattern_head, &fopt, &max_matches);
+		&pattern_head, &fopt, &max_matches
+		IF_FEATURE_GREP_PARALLEL(, &G.jobs));
+#endif
+#if ENABLE_FEATURE_GREP_PARALLEL && ENABLE_FEATURE_GREP_CONTEXT
+	/* Whether "--" is printed depends on output of earlier files */
+	if (lines_before || lines_after)
+		G.jobs = 1;
 #endif
 	invert_search = ((option_mask32 & OPT_v) != 0); /* 0 | 1 */
 
@@ -783,9 +1470,9 @@ int grep_main(int argc UNUSED_PARAM, char **argv)
 		reflags = REG_NOSUB;
 #endif
 
-	if ((ENABLE_EGREP && applet_name[0] == 'e')
-	 || (option_mask32 & OPT_E)
-	) {
+	if (ENABLE_EGREP && applet_name[0] == 'e')
+		option_mask32 |= OPT_E;
+	if (option_mask32 & OPT_E) {
 		reflags |= REG_EXTENDED;
 	}
 #if ENABLE_EXTRA_COMPAT
@@ -816,6 +1503,26 @@ int grep_main(int argc UNUSED_PARAM, char **argv)
 			bb_show_usage();
 		load_pattern_list(&pattern_head, *argv++);
 	}
+#if ENABLE_FEATURE_GREP_FAST_F
+	if (FGREP_FLAG)
+		build_ac();
+#endif
+	if (!FGREP_FLAG) {
+		llist_t *l;
+		for (l = pattern_head; l; l = l->link) {
+			grep_list_data_t *gl = (grep_list_data_t *)l->data;
+			gl->flg_mem_allocated_compiled |= COMPILED;
+#if !ENABLE_EXTRA_COMPAT
+			xregcomp(&gl->compiled_regex, gl->pattern, reflags);
+#else
+			memset(&gl->compiled_regex, 0, sizeof(gl->compiled_regex));
+			gl->compiled_regex.translate = case_fold; /* for -i */
+			if (re_compile_pattern(gl->pattern, strlen(gl->pattern), &gl->compiled_regex))
+				bb_error_msg_and_die("bad regex '%s'", gl->pattern);
+#endif
+			IF_FEATURE_GREP_PREFILTER(gl->literal = regex_literal(gl->pattern);)
+		}
+	}
 
 	/* argv[0..(argc-1)] should be names of file to grep through. If
 	 * there is more than one file to grep, we will print the filenames. */
@@ -870,9 +1577,19 @@ int grep_main(int argc UNUSED_PARAM, char **argv)
 				free(gl->pattern);
 			if (gl->flg_mem_allocated_compiled & COMPILED)
 				regfree(&gl->compiled_regex);
+			IF_FEATURE_GREP_PREFILTER(free(gl->literal);)
 			free(gl);
 			free(pattern_head_ptr);
 		}
+#if ENABLE_FEATURE_GREP_FAST_F
+		if (G.ac) {
+			free(G.ac->st);
+			free(G.ac->ch);
+			free(G.ac->gl);
+			free(G.ac->len);
+			free(G.ac);
+		}
+#endif
 	}
 	/* 0 = success, 1 = failed, 2 = error */
 	if (open_errors)
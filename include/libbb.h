@@ -2573,6 +2573,14 @@ unsigned sha512_end(sha512_ctx_t *ctx, void *resbuf) FAST_FUNC;
 void sha384_begin(sha384_ctx_t *ctx) FAST_FUNC;
 #define sha384_hash sha512_hash
 unsigned sha384_end(sha384_ctx_t *ctx, void *resbuf) FAST_FUNC;
+/* Hash buffer[i] into ctx[i] for i < n <= SHA_MB_LANES, all at once
+ * (using SIMD) if possible. All contexts must be of the same kind */
+#define SHA_MB_LANES 8
+void sha1_hash_mb(sha1_ctx_t **ctx, const void **buffer, const size_t *len, unsigned n) FAST_FUNC;
+void sha256_hash_mb(sha256_ctx_t **ctx, const void **buffer, const size_t *len, unsigned n) FAST_FUNC;
+/* Nonzero if sha*_hash_mb() would hash in parallel (AVX2, no sha insns) */
+int sha1_hash_mb_usable(void) FAST_FUNC;
+int sha256_hash_mb_usable(void) FAST_FUNC;
 #endif
 void sha3_begin(sha3_ctx_t *ctx) FAST_FUNC;
 void sha3_hash(sha3_ctx_t *ctx, const void *buffer, size_t len) FAST_FUNC;
@@ -2638,11 +2646,15 @@ void FAST_FUNC hmac_hash_v(hmac_ctx_t *ctx, va_list va);
 unsigned hmac_peek_hash(hmac_ctx_t *ctx, uint8_t *out, ...);
 
 extern uint32_t *global_crc32_table;
+/* If tbl256 is NULL, allocates a table crc32_block_endianN() can use.
+ * Otherwise only fills 256 entries, for callers with their own loop. */
 uint32_t *crc32_filltable(uint32_t *tbl256, int endian) FAST_FUNC;
 uint32_t *crc32_new_table_le(void) FAST_FUNC;
 uint32_t *global_crc32_new_table_le(void) FAST_FUNC;
 uint32_t crc32_block_endian1(uint32_t val, const void *buf, unsigned len, uint32_t *crc_table) FAST_FUNC;
 uint32_t crc32_block_endian0(uint32_t val, const void *buf, unsigned len, uint32_t *crc_table) FAST_FUNC;
+/* Little-endian (gzip) CRC32 of A+B, given those of A and B, and B's length */
+uint32_t crc32_combine_le(uint32_t crc1, uint32_t crc2, uoff_t len2) FAST_FUNC;
 
 typedef struct masks_labels_t {
 	const char *labels;
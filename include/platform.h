@@ -431,6 +431,7 @@ typedef unsigned smalluint;
 #define HAVE_FDATASYNC 1
 #define HAVE_DPRINTF 1
 #define HAVE_MEMRCHR 1
+#define HAVE_MEMMEM 1
 #define HAVE_MKDTEMP 1
 #define HAVE_TTYNAME_R 1
 #define HAVE_PTSNAME_R 1
@@ -474,6 +475,7 @@ typedef unsigned smalluint;
 # undef HAVE_DPRINTF
 # undef HAVE_GETLINE
 # undef HAVE_MEMRCHR
+# undef HAVE_MEMMEM
 # if !defined(__MINGW64_VERSION_MAJOR) || __MINGW64_VERSION_MAJOR < 14
 # undef HAVE_MKDTEMP
 # endif
@@ -495,6 +497,7 @@ typedef unsigned smalluint;
 # undef HAVE_DPRINTF
 # undef HAVE_GETLINE
 # undef HAVE_MEMRCHR
+# undef HAVE_MEMMEM
 # undef HAVE_MKDTEMP
 # undef HAVE_SETBIT
 # undef HAVE_STPCPY
@@ -615,6 +618,12 @@ extern int dprintf(int fd, const char *format, ...);
 extern void *memrchr(const void *s, int c, size_t n) FAST_FUNC;
 #endif
 
+#ifndef HAVE_MEMMEM
+#include <stddef.h>
+extern void *memmem(const void *haystack, size_t hlen,
+		const void *needle, size_t nlen) FAST_FUNC;
+#endif
+
 #ifndef HAVE_MKDTEMP
 extern char *mkdtemp(char *template) FAST_FUNC;
 #endif
@@ -17,6 +17,19 @@
  */
 #include "libbb.h"
 
+#if ENABLE_CRC32_HWACCEL && defined(__GNUC__) && defined(__x86_64__) \
+ && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || defined(__clang__))
+# define CRC32_PCLMUL 1
+# include <emmintrin.h>
+# include <wmmintrin.h>
+#else
+# define CRC32_PCLMUL 0
+#endif
+
+/* With CRC32_SMALL=0, tables allocated here have 8 slices of 256:
+ * slice k is the crc of a byte followed by k zero bytes */
+#define CRC32_SLICES (CONFIG_CRC32_SMALL ? 1 : 8)
+
 uint32_t *global_crc32_table;
 
 uint32_t* FAST_FUNC crc32_filltable(uint32_t *crc_table, int endian)
@@ -24,9 +37,12 @@ uint32_t* FAST_FUNC crc32_filltable(uint32_t *crc_table, int endian)
 	uint32_t polynomial = endian ? 0x04c11db7 : 0xedb88320;
 	uint32_t c;
 	unsigned i, j;
+	unsigned slices = 1;
 
-	if (!crc_table)
-		crc_table = xmalloc(256 * sizeof(uint32_t));
+	if (!crc_table) {
+		slices = CRC32_SLICES;
+		crc_table = xmalloc(slices * 256 * sizeof(uint32_t));
+	}
 
 	for (i = 0; i < 256; i++) {
 		c = endian ? (i << 24) : i;
@@ -36,10 +52,17 @@ uint32_t* FAST_FUNC crc32_filltable(uint32_t *crc_table, int endian)
 			else
 				c = (c&1) ? ((c >> 1) ^ polynomial) : (c >> 1);
 		}
-		*crc_table++ = c;
+		crc_table[i] = c;
+	}
+	for (i = 256; i < slices * 256; i++) {
+		c = crc_table[i - 256];
+		if (endian)
+			crc_table[i] = (c << 8) ^ crc_table[c >> 24];
+		else
+			crc_table[i] = (c >> 8) ^ crc_table[(uint8_t)c];
 	}
 
-	return crc_table - 256;
+	return crc_table;
 }
 /* Common uses: */
 uint32_t* FAST_FUNC crc32_new_table_le(void)
@@ -56,6 +79,25 @@ uint32_t FAST_FUNC crc32_block_endian1(uint32_t val, const void *buf, unsigned l
 {
 	const void *end = (uint8_t*)buf + len;
 
+#if !CONFIG_CRC32_SMALL
+	const uint8_t *p = buf;
+	const uint32_t *t = crc_table;
+
+	while (len >= 8) {
+		uint32_t a, b;
+		move_from_unaligned32(a, p);
+		move_from_unaligned32(b, p + 4);
+		a = val ^ SWAP_BE32(a);
+		b = SWAP_BE32(b);
+		val = t[7*256 + (a >> 24)] ^ t[6*256 + (uint8_t)(a >> 16)]
+		    ^ t[5*256 + (uint8_t)(a >> 8)] ^ t[4*256 + (uint8_t)a]
+		    ^ t[3*256 + (b >> 24)] ^ t[2*256 + (uint8_t)(b >> 16)]
+		    ^ t[1*256 + (uint8_t)(b >> 8)] ^ t[(uint8_t)b];
+		p += 8;
+		len -= 8;
+	}
+	buf = p;
+#endif
 	while (buf != end) {
 		val = (val << 8) ^ crc_table[(val >> 24) ^ *(uint8_t*)buf];
 		buf = (uint8_t*)buf + 1;
@@ -63,13 +105,183 @@ uint32_t FAST_FUNC crc32_block_endian1(uint32_t val, const void *buf, unsigned l
 	return val;
 }
 
+#if CRC32_PCLMUL
+static smallint pclmul;
+static NOINLINE int get_pclmul(void)
+{
+	unsigned eax = 1, ebx, ecx = 0, edx;
+
+	asm ("cpuid"
+		: "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+		: "0"(eax), "2"(ecx)
+	);
+	pclmul = (ecx & (1 << 1)) ? 1 : -1; /* CPUID.1:ECX.PCLMULQDQ */
+	return pclmul;
+}
+
+/* Fold 64-byte blocks with carry-less multiplication, then Barrett-reduce.
+ * "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+ * Instruction", Intel, 2009. Constants are for the bit-reflected
+ * 0xedb88320 polynomial. len >= 64, multiple of 16.
+ */
+static uint32_t __attribute__((target("pclmul,sse2")))
+crc32_pclmul_le(uint32_t crc, const uint8_t *buf, unsigned len)
+{
+	static const uint64_t k1k2[2] ALIGNED(16) = { 0x0154442bd4, 0x01c6e41596 };
+	static const uint64_t k3k4[2] ALIGNED(16) = { 0x01751997d0, 0x00ccaa009e };
+	static const uint64_t k5k0[2] ALIGNED(16) = { 0x0163cd6124, 0x0000000000 };
+	static const uint64_t poly[2] ALIGNED(16) = { 0x01db710641, 0x01f7011641 };
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	x0 = _mm_load_si128((const __m128i *)k1k2);
+	buf += 64;
+	len -= 64;
+
+	/* Fold 4 x 128 bits in parallel */
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+				_mm_loadu_si128((const __m128i *)(buf + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+				_mm_loadu_si128((const __m128i *)(buf + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+				_mm_loadu_si128((const __m128i *)(buf + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+				_mm_loadu_si128((const __m128i *)(buf + 0x30)));
+		buf += 64;
+		len -= 64;
+	}
+
+	/* Fold into 128 bits */
+	x0 = _mm_load_si128((const __m128i *)k3k4);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	while (len >= 16) {
+		x2 = _mm_loadu_si128((const __m128i *)buf);
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		buf += 16;
+		len -= 16;
+	}
+
+	/* Fold 128 bits to 64 */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+	x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = _mm_load_si128((const __m128i *)poly);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return _mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+#endif
+
 uint32_t FAST_FUNC crc32_block_endian0(uint32_t val, const void *buf, unsigned len, uint32_t *crc_table)
 {
 	const void *end = (uint8_t*)buf + len;
 
+#if CRC32_PCLMUL
+	if (len >= 64) {
+		int hw = pclmul;
+		if (!hw)
+			hw = get_pclmul();
+		if (hw > 0) {
+			val = crc32_pclmul_le(val, buf, len & ~15);
+			buf = (uint8_t*)buf + (len & ~15);
+			len &= 15;
+		}
+	}
+#endif
+#if !CONFIG_CRC32_SMALL
+	{
+		const uint8_t *p = buf;
+		const uint32_t *t = crc_table;
+
+		while (len >= 8) {
+			uint32_t a, b;
+			move_from_unaligned32(a, p);
+			move_from_unaligned32(b, p + 4);
+			a = val ^ SWAP_LE32(a);
+			b = SWAP_LE32(b);
+			val = t[7*256 + (uint8_t)a] ^ t[6*256 + (uint8_t)(a >> 8)]
+			    ^ t[5*256 + (uint8_t)(a >> 16)] ^ t[4*256 + (a >> 24)]
+			    ^ t[3*256 + (uint8_t)b] ^ t[2*256 + (uint8_t)(b >> 8)]
+			    ^ t[1*256 + (uint8_t)(b >> 16)] ^ t[b >> 24];
+			p += 8;
+			len -= 8;
+		}
+		buf = p;
+	}
+#endif
 	while (buf != end) {
 		val = crc_table[(uint8_t)val ^ *(uint8_t*)buf] ^ (val >> 8);
 		buf = (uint8_t*)buf + 1;
 	}
 	return val;
 }
+
+/* Multiply a and b modulo the bit-reflected crc polynomial */
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m = (uint32_t)1 << 31;
+	uint32_t p = 0;
+
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = (b >> 1) ^ ((b & 1) ? 0xedb88320 : 0);
+	}
+	return p;
+}
+
+/* Appending len2 bytes to A multiplies its crc by x^(8*len2):
+ * square-and-multiply that, then add B's crc */
+uint32_t FAST_FUNC crc32_combine_le(uint32_t crc1, uint32_t crc2, uoff_t len2)
+{
+	uint32_t xn = (uint32_t)1 << 23;	/* x^8: one byte */
+	uint32_t p = (uint32_t)1 << 31;		/* x^0 */
+
+	while (len2) {
+		if (len2 & 1)
+			p = multmodp(xn, p);
+		xn = multmodp(xn, xn);
+		len2 >>= 1;
+	}
+	return multmodp(p, crc1) ^ crc2;
+}
@@ -13,6 +13,14 @@
 
 #define NEED_SHA512 (ENABLE_SHA512SUM || ENABLE_SHA384SUM || ENABLE_USE_BB_CRYPT_SHA)
 
+/* Multi-buffer sha1/sha256: gcc vector extensions, compiled for AVX2 */
+#if ENABLE_SHA_MULTIBUFFER && !ENABLE_FEATURE_USE_CNG_API \
+ && defined(__GNUC__) && defined(__x86_64__)
+# define SHA_MB_SIMD 1
+#else
+# define SHA_MB_SIMD 0
+#endif
+
 #if ENABLE_FEATURE_USE_CNG_API
 # include <windows.h>
 # include <bcrypt.h>
@@ -135,7 +143,7 @@ unsigned FAST_FUNC generic_end(bcrypt_hash_ctx_t *ctx, void *resbuf)
 }
 #endif /* !ENABLE_FEATURE_USE_CNG_API */
 
-#if ENABLE_SHA1_HWACCEL || ENABLE_SHA256_HWACCEL
+#if ENABLE_SHA1_HWACCEL || ENABLE_SHA256_HWACCEL || SHA_MB_SIMD
 # if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
 static void cpuid_eax_ebx_ecx(unsigned *eax, unsigned *ebx, unsigned *ecx, unsigned *edx)
 {
@@ -144,6 +152,10 @@ static void cpuid_eax_ebx_ecx(unsigned *eax, unsigned *ebx, unsigned *ecx, unsig
 		: "0" (*eax), "1" (*ebx), "2" (*ecx)
 	);
 }
+# endif
+#endif
+#if ENABLE_SHA1_HWACCEL || ENABLE_SHA256_HWACCEL
+# if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
 static smallint shaNI;
 static NOINLINE int get_shaNI(void)
 {
@@ -1473,6 +1485,329 @@ unsigned FAST_FUNC sha1_end(sha1_ctx_t *ctx, void *resbuf)
 	return hash_size;
 }
 
+#if SHA_MB_SIMD
+/*
+ * Multi-buffer sha1/sha256: SHA_MB_LANES independent messages are
+ * hashed at once, lane i of every vector holding the state of message i.
+ * Without sha instructions, this is 2-4 times faster than hashing
+ * them one by one.
+ */
+typedef uint32_t mb_u32 __attribute__((vector_size(SHA_MB_LANES * 4)));
+
+static smallint have_avx2;
+static NOINLINE int get_avx2(void)
+{
+	unsigned eax, ebx, ecx, edx;
+	int r = -1;
+
+	eax = 1;
+	ebx = ecx = 0;
+	cpuid_eax_ebx_ecx(&eax, &ebx, &ecx, &edx);
+	/* OSXSAVE and AVX, and the OS saves ymm registers */
+	if ((ecx & (3 << 27)) == (3 << 27)) {
+		uint32_t xcr0_lo, xcr0_hi;
+		asm ("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+		if ((xcr0_lo & 6) == 6) {
+			eax = 7;
+			ebx = ecx = 0;
+			cpuid_eax_ebx_ecx(&eax, &ebx, &ecx, &edx);
+			if (ebx & (1 << 5)) /* AVX2 */
+				r = 1;
+		}
+	}
+	have_avx2 = r;
+	return r;
+}
+
+static int mb_avx2(void)
+{
+	int avx2 = have_avx2;
+	if (!avx2)
+		avx2 = get_avx2();
+	return avx2 > 0;
+}
+
+#define MB_ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define MB_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/* Load big-endian words t..t+15 of each lane's block */
+static ALWAYS_INLINE void mb_load_block(mb_u32 W[16], const uint8_t *const block[SHA_MB_LANES])
+{
+	unsigned t, i;
+
+	for (t = 0; t < 16; t++)
+		for (i = 0; i < SHA_MB_LANES; i++)
+			W[t][i] = get_unaligned_be32(block[i] + t * 4);
+}
+
+static ALWAYS_INLINE void sha1_mb_block(uint32_t *const hash[SHA_MB_LANES], const uint8_t *const block[SHA_MB_LANES])
+{
+	static const uint32_t rconsts[] ALIGN4 = {
+		0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6
+	};
+	mb_u32 W[16], a, b, c, d, e;
+	unsigned t, i;
+
+	mb_load_block(W, block);
+	for (i = 0; i < SHA_MB_LANES; i++) {
+		a[i] = hash[i][0];
+		b[i] = hash[i][1];
+		c[i] = hash[i][2];
+		d[i] = hash[i][3];
+		e[i] = hash[i][4];
+	}
+	for (t = 0; t < 80; t++) {
+		mb_u32 f, work;
+
+		if (t >= 16) {
+			work = W[(t + 13) & 15] ^ W[(t + 8) & 15] ^ W[(t + 2) & 15] ^ W[t & 15];
+			W[t & 15] = MB_ROTL(work, 1);
+		}
+		if (t < 20)
+			f = ((c ^ d) & b) ^ d;
+		else if (t < 40 || t >= 60)
+			f = b ^ c ^ d;
+		else
+			f = ((b | c) & d) | (b & c);
+		work = MB_ROTL(a, 5) + f + e + rconsts[t / 20] + W[t & 15];
+		e = d;
+		d = c;
+		c = MB_ROTL(b, 30);
+		b = a;
+		a = work;
+	}
+	for (i = 0; i < SHA_MB_LANES; i++) {
+		hash[i][0] += a[i];
+		hash[i][1] += b[i];
+		hash[i][2] += c[i];
+		hash[i][3] += d[i];
+		hash[i][4] += e[i];
+	}
+}
+
+static ALWAYS_INLINE void sha256_mb_block(uint32_t *const hash[SHA_MB_LANES], const uint8_t *const block[SHA_MB_LANES])
+{
+	mb_u32 W[16], a, b, c, d, e, f, g, h;
+	unsigned t, i;
+
+	mb_load_block(W, block);
+	for (i = 0; i < SHA_MB_LANES; i++) {
+		a[i] = hash[i][0];
+		b[i] = hash[i][1];
+		c[i] = hash[i][2];
+		d[i] = hash[i][3];
+		e[i] = hash[i][4];
+		f[i] = hash[i][5];
+		g[i] = hash[i][6];
+		h[i] = hash[i][7];
+	}
+	for (t = 0; t < 64; t++) {
+		uint32_t K_t = NEED_SHA512 ? (sha_K[t] >> 32) : sha_K[t];
+		mb_u32 T1, T2;
+
+		if (t >= 16) {
+			mb_u32 w2 = W[(t - 2) & 15];
+			mb_u32 w15 = W[(t - 15) & 15];
+			W[t & 15] += (MB_ROTR(w2, 17) ^ MB_ROTR(w2, 19) ^ (w2 >> 10))
+				+ W[(t - 7) & 15]
+				+ (MB_ROTR(w15, 7) ^ MB_ROTR(w15, 18) ^ (w15 >> 3));
+		}
+		T1 = h + (MB_ROTR(e, 6) ^ MB_ROTR(e, 11) ^ MB_ROTR(e, 25))
+			+ ((e & f) ^ (~e & g)) + K_t + W[t & 15];
+		T2 = (MB_ROTR(a, 2) ^ MB_ROTR(a, 13) ^ MB_ROTR(a, 22))
+			+ ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + T1;
+		d = c;
+		c = b;
+		b = a;
+		a = T1 + T2;
+	}
+	for (i = 0; i < SHA_MB_LANES; i++) {
+		hash[i][0] += a[i];
+		hash[i][1] += b[i];
+		hash[i][2] += c[i];
+		hash[i][3] += d[i];
+		hash[i][4] += e[i];
+		hash[i][5] += f[i];
+		hash[i][6] += g[i];
+		hash[i][7] += h[i];
+	}
+}
+#undef MB_ROTL
+#undef MB_ROTR
+
+static void __attribute__((target("avx2")))
+sha1_mb_block_avx2(uint32_t *const hash[SHA_MB_LANES], const uint8_t *const block[SHA_MB_LANES])
+{
+	sha1_mb_block(hash, block);
+}
+
+static void __attribute__((target("avx2")))
+sha256_mb_block_avx2(uint32_t *const hash[SHA_MB_LANES], const uint8_t *const block[SHA_MB_LANES])
+{
+	sha256_mb_block(hash, block);
+}
+
+static void sha_hash_mb(md5_ctx_t **ctx, const void **buffer, const size_t *len, unsigned n,
+		void (*mb_block)(uint32_t *const hash[SHA_MB_LANES], const uint8_t *const block[SHA_MB_LANES]))
+{
+	/* Lanes with less than a block to hash use these */
+	uint32_t dummy_hash[8];
+	uint8_t dummy_block[64];
+	uint32_t *hash[SHA_MB_LANES];
+	const uint8_t *block[SHA_MB_LANES];
+	const uint8_t *p[SHA_MB_LANES];
+	size_t left[SHA_MB_LANES];
+	unsigned i;
+
+	for (i = 0; i < n; i++) {
+		unsigned bufpos = ctx[i]->total64 & 63;
+		p[i] = buffer[i];
+		left[i] = len[i];
+		if (bufpos != 0) {
+			/* Complete the partial block the usual way */
+			size_t k = MIN(64 - bufpos, left[i]);
+			md5_hash(ctx[i], p[i], k);
+			p[i] += k;
+			left[i] -= k;
+		}
+	}
+	while (1) {
+		unsigned active = 0;
+		for (i = 0; i < SHA_MB_LANES; i++) {
+			hash[i] = dummy_hash;
+			block[i] = dummy_block;
+			if (i < n && left[i] >= 64) {
+				hash[i] = ctx[i]->hash;
+				block[i] = p[i];
+				active++;
+			}
+		}
+		/* For one message, the single-buffer code is faster */
+		if (active < 2)
+			break;
+		mb_block(hash, block);
+		for (i = 0; i < n; i++) {
+			if (block[i] != dummy_block) {
+				p[i] += 64;
+				left[i] -= 64;
+				ctx[i]->total64 += 64;
+			}
+		}
+	}
+	for (i = 0; i < n; i++)
+		md5_hash(ctx[i], p[i], left[i]);
+}
+#endif /* SHA_MB_SIMD */
+
+/* Hash buffer[i] into ctx[i], i < n <= SHA_MB_LANES */
+void FAST_FUNC sha1_hash_mb(sha1_ctx_t **ctx, const void **buffer, const size_t *len, unsigned n)
+{
+#if SHA_MB_SIMD
+	/* With sha instructions, one message at a time is faster */
+	if (n > 1 && ctx[0]->process_block == sha1_process_block64 && mb_avx2()) {
+		sha_hash_mb(ctx, buffer, len, n, sha1_mb_block_avx2);
+		return;
+	}
+#endif
+	while (n--)
+		md5_hash(ctx[n], buffer[n], len[n]);
+}
+
+void FAST_FUNC sha256_hash_mb(sha256_ctx_t **ctx, const void **buffer, const size_t *len, unsigned n)
+{
+#if SHA_MB_SIMD
+	if (n > 1 && ctx[0]->process_block == sha256_process_block64 && mb_avx2()) {
+		sha_hash_mb(ctx, buffer, len, n, sha256_mb_block_avx2);
+		return;
+	}
+#endif
+	while (n--)
+		md5_hash(ctx[n], buffer[n], len[n]);
+}
+
+/* Do sha*_hash_mb() hash messages in parallel, or one by one? */
+int FAST_FUNC sha1_hash_mb_usable(void)
+{
+#if SHA_MB_SIMD
+	sha1_ctx_t ctx;
+	sha1_begin(&ctx);
+	return ctx.process_block == sha1_process_block64 && mb_avx2();
+#else
+	return 0;
+#endif
+}
+
+int FAST_FUNC sha256_hash_mb_usable(void)
+{
+#if SHA_MB_SIMD
+	sha256_ctx_t ctx;
+	sha256_begin(&ctx);
+	return ctx.process_block == sha256_process_block64 && mb_avx2();
+#else
+	return 0;
+#endif
+}
+
+#if ENABLE_UNIT_TEST && SHA_MB_SIMD
+/* The AVX2 code is not used on CPUs with sha instructions: test it
+ * directly against the generic code. Messages of different lengths
+ * end at different blocks, the second pass starts in partial ones */
+static int mb_test_differs(int sha256)
+{
+	static const size_t len[SHA_MB_LANES] = { 0, 1, 63, 64, 65, 1000, 4096, 5000 };
+	sha256_ctx_t ctx_buf[SHA_MB_LANES], ref;
+	sha256_ctx_t *ctx[SHA_MB_LANES];
+	const void *buffer[SHA_MB_LANES];
+	uint8_t digest[32], ref_digest[32];
+	uint8_t msg[5000 + SHA_MB_LANES];
+	unsigned i;
+
+	for (i = 0; i < sizeof(msg); i++)
+		msg[i] = i * 7 + (i >> 8);
+	for (i = 0; i < SHA_MB_LANES; i++) {
+		ctx[i] = &ctx_buf[i];
+		if (sha256)
+			sha256_begin(ctx[i]);
+		else
+			sha1_begin(ctx[i]);
+		buffer[i] = msg + i;
+	}
+	sha_hash_mb(ctx, buffer, len, SHA_MB_LANES, sha256 ? sha256_mb_block_avx2 : sha1_mb_block_avx2);
+	sha_hash_mb(ctx, buffer, len, SHA_MB_LANES, sha256 ? sha256_mb_block_avx2 : sha1_mb_block_avx2);
+	for (i = 0; i < SHA_MB_LANES; i++) {
+		if (sha256) {
+			sha256_begin(&ref);
+			ref.process_block = sha256_process_block64;
+		} else {
+			sha1_begin(&ref);
+			ref.process_block = sha1_process_block64;
+		}
+		md5_hash(&ref, msg + i, len[i]);
+		md5_hash(&ref, msg + i, len[i]);
+		memset(digest, 0, sizeof(digest));
+		memset(ref_digest, 0, sizeof(ref_digest));
+		sha1_end(ctx[i], digest);
+		sha1_end(&ref, ref_digest);
+		if (memcmp(digest, ref_digest, sizeof(digest)) != 0)
+			return 1;
+	}
+	return 0;
+}
+
+BBUNIT_DEFINE_TEST(sha_hash_mb)
+{
+	if (mb_avx2()) {
+		BBUNIT_ASSERT_FALSE(mb_test_differs(0));
+		BBUNIT_ASSERT_FALSE(mb_test_differs(1));
+	}
+	BBUNIT_ENDTEST;
+}
+#endif
+
 #if NEED_SHA512
 static unsigned FAST_FUNC sha512384_end(sha512_ctx_t *ctx, void *resbuf, unsigned outsize)
 {
@@ -102,6 +102,28 @@ void* FAST_FUNC memrchr(const void *s, int c, size_t n)
 }
 #endif
 
+#ifndef HAVE_MEMMEM
+/* memmem() is a GNU function too: find a byte string in a memory block */
+void* FAST_FUNC memmem(const void *haystack, size_t hlen,
+		const void *needle, size_t nlen)
+{
+	const char *p = haystack;
+	const char *end = p + hlen;
+
+	if (nlen == 0)
+		return (void *) p;
+	while ((size_t)(end - p) >= nlen) {
+		p = memchr(p, *(const char *)needle, end - p - nlen + 1);
+		if (!p)
+			break;
+		if (memcmp(p, needle, nlen) == 0)
+			return (void *) p;
+		p++;
+	}
+	return NULL;
+}
+#endif
+
 #ifndef HAVE_MKDTEMP
 /* This is now actually part of POSIX.1, but was only added in 2008 */
 char* FAST_FUNC mkdtemp(char *template)
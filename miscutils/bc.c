@@ -266,6 +266,12 @@ typedef struct BcVec {
 
 typedef signed char BcDig;
 
+// Multiplication and division pack nine decimal digits into one
+// base 10^9 "limb", doing 81 digit products per machine multiply
+typedef uint32_t BcLimb;
+#define BC_LIMB_DIGS    9
+#define BC_LIMB_BASE    1000000000
+
 typedef struct BcNum {
 	BcDig *restrict num;
 	size_t rdx;
@@ -279,7 +285,9 @@ typedef struct BcNum {
 #define BC_NUM_DEF_SIZE         16
 #define BC_NUM_PRINT_WIDTH      70
 
-#define BC_NUM_KARATSUBA_LEN    32
+// In decimal digits. Base case works on limbs and is quite fast,
+// Karatsuba recursion works on digits and pays for allocations:
+#define BC_NUM_KARATSUBA_LEN    (128 * BC_LIMB_DIGS)
 
 typedef enum BcInst {
 #if ENABLE_BC
@@ -1874,6 +1882,160 @@ static FAST_FUNC BC_STATUS zbc_num_s(BcNum *a, BcNum *b, BcNum *restrict c, size
 	RETURN_STATUS(BC_STATUS_SUCCESS); // can't make void, see zbc_num_binary()
 }
 
+static size_t bc_limbs_from_digs(BcLimb *l, const BcDig *d, size_t len)
+{
+	BcLimb *start = l;
+
+	while (len != 0) {
+		size_t k = len < BC_LIMB_DIGS ? len : BC_LIMB_DIGS;
+		BcLimb v = 0;
+		len -= k;
+		while (k != 0)
+			v = v * 10 + d[--k];
+		*l++ = v;
+		d += BC_LIMB_DIGS;
+	}
+	// Drop leading zero limbs
+	while (l != start && l[-1] == 0)
+		l--;
+	return l - start;
+}
+
+// Fill d[0..len) with digits of limbs l[0..n), zero-padded
+static void bc_limbs_to_digs(BcDig *d, size_t len, const BcLimb *l, size_t n)
+{
+	while (len != 0) {
+		size_t k = len < BC_LIMB_DIGS ? len : BC_LIMB_DIGS;
+		BcLimb v = 0;
+		if (n != 0) {
+			v = *l++;
+			n--;
+		}
+		len -= k;
+		while (k != 0) {
+			*d++ = v % 10;
+			v /= 10;
+			k--;
+		}
+	}
+}
+
+// c[0..na+nb) = a[0..na) * b[0..nb)
+static BC_STATUS zbc_limbs_mul(BcLimb *restrict c,
+		const BcLimb *a, size_t na, const BcLimb *b, size_t nb)
+{
+	size_t i, j;
+
+	memset(c, 0, (na + nb) * sizeof(c[0]));
+	for (i = 0; i < nb; ++i) {
+		uint64_t bi = b[i];
+		uint32_t carry = 0;
+		if (bi == 0)
+			continue;
+		for (j = 0; j < na; ++j) {
+			// < 10^18 + 2 * 10^9, fits
+			uint64_t t = a[j] * bi + c[i + j] + carry;
+			carry = t / BC_LIMB_BASE;
+			c[i + j] = t % BC_LIMB_BASE;
+		}
+		c[i + na] = carry;
+#if ENABLE_FEATURE_BC_INTERACTIVE
+		// a=2^1000000
+		// a*a <- without check below, this will not be interruptible
+		if (G_interrupt) RETURN_STATUS(BC_STATUS_FAILURE);
+#endif
+	}
+	RETURN_STATUS(BC_STATUS_SUCCESS);
+}
+#define zbc_limbs_mul(...) (zbc_limbs_mul(__VA_ARGS__) COMMA_SUCCESS)
+
+// q[0..nu-nv+1) = u[0..nu) / v[0..nv), nu >= nv, v[nv-1] != 0.
+// Knuth's algorithm D. Clobbers u and v, u must have room for nu+1 limbs.
+static BC_STATUS zbc_limbs_div(BcLimb *restrict q,
+		BcLimb *restrict u, size_t nu, BcLimb *restrict v, size_t nv)
+{
+	uint32_t d, carry;
+	size_t i, j;
+
+	if (nv == 1) {
+		uint64_t r = 0;
+		for (j = nu; j-- != 0;) {
+			r = r * BC_LIMB_BASE + u[j];
+			q[j] = r / v[0];
+			r %= v[0];
+		}
+		RETURN_STATUS(BC_STATUS_SUCCESS);
+	}
+
+	// Normalize so that top limb of v is >= BASE/2:
+	// makes qhat estimate below off by at most 2
+	d = BC_LIMB_BASE / ((uint64_t)v[nv - 1] + 1);
+	carry = 0;
+	for (i = 0; i < nv; ++i) {
+		uint64_t t = (uint64_t)v[i] * d + carry;
+		carry = t / BC_LIMB_BASE;
+		v[i] = t % BC_LIMB_BASE;
+	}
+	carry = 0;
+	for (i = 0; i < nu; ++i) {
+		uint64_t t = (uint64_t)u[i] * d + carry;
+		carry = t / BC_LIMB_BASE;
+		u[i] = t % BC_LIMB_BASE;
+	}
+	u[nu] = carry;
+
+	for (j = nu - nv + 1; j-- != 0;) {
+		BcLimb *w = u + j;
+		uint64_t num, qhat, rhat;
+		int64_t t;
+		uint32_t borrow;
+
+		num = (uint64_t)w[nv] * BC_LIMB_BASE + w[nv - 1];
+		qhat = num / v[nv - 1];
+		rhat = num % v[nv - 1];
+		while (qhat >= BC_LIMB_BASE
+		 || qhat * v[nv - 2] > rhat * BC_LIMB_BASE + w[nv - 2]
+		) {
+			qhat--;
+			rhat += v[nv - 1];
+			if (rhat >= BC_LIMB_BASE)
+				break;
+		}
+
+		// w[0..nv] -= qhat * v
+		carry = borrow = 0;
+		for (i = 0; i < nv; ++i) {
+			uint64_t p = qhat * v[i] + carry;
+			carry = p / BC_LIMB_BASE;
+			t = (int64_t)w[i] - (int64_t)(p % BC_LIMB_BASE) - borrow;
+			borrow = (t < 0);
+			w[i] = t + (borrow ? BC_LIMB_BASE : 0);
+		}
+		t = (int64_t)w[nv] - carry - borrow;
+		if (t < 0) {
+			// Rare: qhat was one too large, add v back
+			qhat--;
+			carry = 0;
+			for (i = 0; i < nv; ++i) {
+				uint32_t s = w[i] + v[i] + carry;
+				carry = (s >= BC_LIMB_BASE);
+				w[i] = s - (carry ? BC_LIMB_BASE : 0);
+			}
+			t += carry;
+		}
+		w[nv] = t;
+		q[j] = qhat;
+#if ENABLE_FEATURE_BC_INTERACTIVE
+		// a=2^100000
+		// scale=40000
+		// 1/a <- without check below, this will not be interruptible
+		if (G_interrupt) RETURN_STATUS(BC_STATUS_FAILURE);
+#endif
+	}
+	RETURN_STATUS(BC_STATUS_SUCCESS);
+}
+#define zbc_limbs_div(...) (zbc_limbs_div(__VA_ARGS__) COMMA_SUCCESS)
+
 static FAST_FUNC BC_STATUS zbc_num_k(BcNum *restrict a, BcNum *restrict b,
                          BcNum *restrict c)
 #define zbc_num_k(...) (zbc_num_k(__VA_ARGS__) COMMA_SUCCESS)
@@ -1897,36 +2059,29 @@ static FAST_FUNC BC_STATUS zbc_num_k(BcNum *restrict a, BcNum *restrict b,
 	 || b->len < BC_NUM_KARATSUBA_LEN
 	/* || a->len + b->len < BC_NUM_KARATSUBA_LEN - redundant check */
 	) {
-		size_t i, j, len;
-
-		bc_num_expand(c, a->len + b->len + 1);
-
-		memset(c->num, 0, sizeof(BcDig) * c->cap);
-		c->len = len = 0;
-
-		for (i = 0; i < b->len; ++i) {
-			unsigned carry = 0;
-			for (j = 0; j < a->len; ++j) {
-				unsigned in = c->num[i + j];
-				in += (unsigned)a->num[j] * (unsigned)b->num[i] + carry;
-				// note: compilers prefer _unsigned_ div/const
-				carry = in / 10;
-				c->num[i + j] = (BcDig)(in % 10);
-			}
-
-			c->num[i + j] += (BcDig) carry;
-			len = BC_MAX(len, i + j + !!carry);
-
-#if ENABLE_FEATURE_BC_INTERACTIVE
-			// a=2^1000000
-			// a*a <- without check below, this will not be interruptible
-			if (G_interrupt) return BC_STATUS_FAILURE;
-#endif
+		BcLimb *la, *lb, *lc;
+		size_t na, nb;
+
+		na = (a->len + BC_LIMB_DIGS - 1) / BC_LIMB_DIGS;
+		nb = (b->len + BC_LIMB_DIGS - 1) / BC_LIMB_DIGS;
+		la = xmalloc((na + nb) * 2 * sizeof(la[0]));
+		lb = la + na;
+		lc = lb + nb;
+		na = bc_limbs_from_digs(la, a->num, a->len);
+		nb = bc_limbs_from_digs(lb, b->num, b->len);
+
+		s = zbc_limbs_mul(lc, la, na, lb, nb);
+		if (s == BC_STATUS_SUCCESS) {
+			bc_num_expand(c, a->len + b->len + 1);
+			memset(c->num, 0, sizeof(BcDig) * c->cap);
+			bc_limbs_to_digs(c->num, a->len + b->len, lc, na + nb);
+			c->rdx = 0;
+			c->len = a->len + b->len;
+			bc_num_clean(c);
 		}
+		free(la);
 
-		c->len = len;
-
-		RETURN_STATUS(BC_STATUS_SUCCESS);
+		RETURN_STATUS(s);
 	}
 
 	max = BC_MAX(a->len, b->len);
@@ -2025,7 +2180,8 @@ static FAST_FUNC BC_STATUS zbc_num_m(BcNum *a, BcNum *b, BcNum *restrict c, size
 static FAST_FUNC BC_STATUS zbc_num_d(BcNum *a, BcNum *b, BcNum *restrict c, size_t scale)
 {
 	BcStatus s;
-	size_t len, end, i;
+	size_t len, end, nu, nv;
+	BcLimb *lu, *lv, *lq;
 	BcNum cp;
 
 	if (b->len == 0)
@@ -2072,27 +2228,25 @@ static FAST_FUNC BC_STATUS zbc_num_d(BcNum *a, BcNum *b, BcNum *restrict c, size
 	bc_num_expand(c, cp.len);
 
 	bc_num_zero(c);
-	memset(c->num + end, 0, (c->cap - end) * sizeof(BcDig));
+	memset(c->num, 0, c->cap * sizeof(BcDig));
 	c->rdx = cp.rdx;
 	c->len = cp.len;
 
+	// Quotient digits c->num[0..end) are integer cp.num / b->num[0..len)
+	nu = (cp.len + BC_LIMB_DIGS - 1) / BC_LIMB_DIGS;
+	nv = (len + BC_LIMB_DIGS - 1) / BC_LIMB_DIGS;
+	lu = xmalloc((nu + 1 + nv + nu) * sizeof(lu[0]));
+	lv = lu + nu + 1;
+	lq = lv + nv;
+	nu = bc_limbs_from_digs(lu, cp.num, cp.len);
+	nv = bc_limbs_from_digs(lv, b->num, len);
 	s = BC_STATUS_SUCCESS;
-	for (i = end - 1; i < end; --i) {
-		BcDig *n, q;
-		n = cp.num + i;
-		for (q = 0; n[len] != 0 || bc_num_compare(n, b->num, len) >= 0; ++q)
-			bc_num_subArrays(n, b->num, len);
-		c->num[i] = q;
-#if ENABLE_FEATURE_BC_INTERACTIVE
-		// a=2^100000
-		// scale=40000
-		// 1/a <- without check below, this will not be interruptible
-		if (G_interrupt) {
-			s = BC_STATUS_FAILURE;
-			break;
-		}
-#endif
+	if (nu >= nv) {
+		s = zbc_limbs_div(lq, lu, nu, lv, nv);
+		if (s == BC_STATUS_SUCCESS)
+			bc_limbs_to_digs(c->num, end, lq, nu - nv + 1);
 	}
+	free(lu);
 
 	bc_num_retireMul(c, scale, a->neg, b->neg);
 	bc_num_free(&cp);
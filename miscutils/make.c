@@ -63,7 +63,8 @@
 //usage:	)
 //usage:     "\n    -C DIR   Change to DIR"
 //usage:     "\n    -f FILE  Makefile"
-//usage:     "\n    -j NUM   Jobs to run in parallel (not implemented)"
+//usage:     "\n    -j NUM   Jobs to run in parallel"
+//usage:	IF_PLATFORM_MINGW32(" (not implemented)")
 //usage:	IF_FEATURE_MAKE_POSIX(
 //usage:     "\n    -x PRAG  Make POSIX mode less strict"
 //usage:	)
@@ -176,6 +177,7 @@ struct name {
 	struct rule *n_rule;	// Rules to build this (prerequisites/commands)
 	struct timespec n_tim;	// Modification time of this name
 	uint16_t n_flag;		// Info about the name
+	uint8_t n_estat;		// Status of make() once N_DONE is set
 };
 
 #define N_DOING		0x01	// Name in process of being built
@@ -189,6 +191,10 @@ struct name {
 #define N_MARK		0x100	// Mark for deduplication
 #define N_PHONY		0x200	// Name is a phony target
 #define N_INFERENCE	0x400	// Inference rule
+#define N_WAIT		0x800	// .WAIT in a list of prerequisites
+#define N_RUNNING	0x1000	// Commands are being run by a job
+#define N_PENDING	0x2000	// Waiting for a job in this pass
+#define N_INFERRED	0x4000	// Prerequisite from inference rule added
 
 // List of rules to build a target
 struct rule {
@@ -216,6 +222,15 @@ struct cmd {
 	int c_dispno;			// Line number within makefile
 };
 
+#if !ENABLE_PLATFORM_MINGW32
+// A child process running the commands for a target
+struct job {
+	struct job *j_next;		// Next running job
+	struct name *j_name;	// Target being made
+	pid_t j_pid;			// Process id of the job
+};
+#endif
+
 // Macro storage
 struct macro {
 	struct macro *m_next;	// Next variable
@@ -256,6 +271,10 @@ enum {
 // Status of make()
 #define MAKE_FAILURE		0x01
 #define MAKE_DIDSOMETHING	0x02
+#define MAKE_PENDING		0x04	// Waiting for a job to finish
+
+// Exit status of a job that ran to completion, ORed with status of make()
+#define JOB_EXIT			0x10
 
 // Return TRUE if c is allowed in a POSIX 2017 macro or target name
 #define ispname(c) (isalpha(c) || isdigit(c) || c == '.' || c == '_')
@@ -283,6 +302,12 @@ struct globals {
 	uint8_t clevel;
 	uint8_t cstate[IF_MAX + 1];
 	int numjobs;
+#if !ENABLE_PLATFORM_MINGW32
+	bool parallel;
+	int tokens;			// Jobserver tokens held
+	int jobserver[2];	// Jobserver pipe
+	struct job *jobhead;
+#endif
 #if ENABLE_FEATURE_MAKE_POSIX
 	bool posix;
 	bool seen_first;
@@ -314,6 +339,14 @@ struct globals {
 #define clevel		(G.clevel)
 #define cstate		(G.cstate)
 #define numjobs		(G.numjobs)
+#if !ENABLE_PLATFORM_MINGW32
+#define parallel	(G.parallel)
+#define tokens		(G.tokens)
+#define jobserver	(G.jobserver)
+#define jobhead		(G.jobhead)
+#else
+#define parallel	FALSE
+#endif
 #if ENABLE_FEATURE_MAKE_POSIX
 #define posix		(G.posix)
 #define seen_first	(G.seen_first)
@@ -372,6 +405,10 @@ diagnostic(const char *msg, ...)
 	va_end(list);
 }
 
+#if !ENABLE_PLATFORM_MINGW32
+static void finish_jobs(void);
+#endif
+
 /*
  * Error handler.  Print message and exit.
  */
@@ -384,6 +421,10 @@ error(const char *msg, ...)
 	va_start(list, msg);
 	vwarning(stderr, msg, list);
 	va_end(list);
+#if !ENABLE_PLATFORM_MINGW32
+	if (parallel)
+		finish_jobs();
+#endif
 	exit(2);
 }
 
@@ -2481,9 +2522,9 @@ input(FILE *fd, int ilevel)
 				files = gd.gl_pathv;
 			}
 			for (i = 0; i < nfile; ++i) {
-				if (!POSIX_2017 && strcmp(files[i], ".WAIT") == 0)
-					continue;
 				np = newname(files[i]);
+				if (!POSIX_2017 && strcmp(files[i], ".WAIT") == 0)
+					np->n_flag |= N_WAIT;
 				newdep(&dp, np);
 			}
 			if (files != &p)
@@ -2839,6 +2880,180 @@ timespec_max(const struct timespec *t, const struct timespec *p)
 	return timespec_le(t, p) ? p : t;
 }
 
+/*
+ * Update the modification time of a target after doing something to it.
+ * If the target doesn't exist assume it was made just now.
+ */
+static void
+update_mtime(struct name *np)
+{
+	modtime(np);
+	if (!np->n_tim.tv_sec)
+		clock_gettime(CLOCK_REALTIME, &np->n_tim);
+}
+
+#if !ENABLE_PLATFORM_MINGW32
+/*
+ * Jobs are managed using a jobserver:  a pipe which is shared with
+ * recursive invocations of make through PDPMAKE_JOBSERVER.  Each make
+ * has one implicit job slot.  Further concurrent jobs require a token
+ * to be read from the pipe and the token is written back when the job
+ * finishes.  The read end of the pipe is non-blocking:  if no token is
+ * available we wait for one of our own jobs to finish instead.
+ */
+static void
+init_jobserver(void)
+{
+	const char *s = getenv("PDPMAKE_JOBSERVER");
+	struct stat st;
+
+	parallel = TRUE;
+
+	// Share the job slots of a parent make, if possible
+	if (s && sscanf(s, "%d,%d", &jobserver[0], &jobserver[1]) == 2 &&
+			fstat(jobserver[0], &st) == 0 && S_ISFIFO(st.st_mode) &&
+			(fcntl(jobserver[0], F_GETFL) & (O_ACCMODE | O_NONBLOCK)) ==
+				(O_RDONLY | O_NONBLOCK) &&
+			fcntl(jobserver[1], F_GETFL) != -1)
+		return;
+
+	xpipe(jobserver);
+	ndelay_on(jobserver[0]);
+	for (int i = 1; i < numjobs && i <= PIPE_BUF; ++i)
+		xwrite(jobserver[1], "+", 1);
+	setenv("PDPMAKE_JOBSERVER",
+			auto_string(xasprintf("%d,%d", jobserver[0], jobserver[1])), 1);
+}
+
+/*
+ * Let running jobs finish and give back the tokens they held, so
+ * that a parent make sharing the jobserver doesn't lose job slots.
+ */
+static void
+finish_jobs(void)
+{
+	struct job *jp;
+
+	while ((jp = jobhead)) {
+		safe_waitpid(jp->j_pid, NULL, 0);
+		jobhead = jp->j_next;
+		free(jp);
+	}
+	for (; tokens; tokens--)
+		xwrite(jobserver[1], "+", 1);
+}
+
+/*
+ * Wait for a job to finish and record its status.
+ */
+static void
+wait_job(void)
+{
+	struct job *jp, **jpp;
+	struct name *np;
+	int status;
+	pid_t pid;
+
+	pid = safe_waitpid(-1, &status, 0);
+	if (pid < 0)
+		bb_simple_perror_msg_and_die("wait");
+
+	for (jpp = &jobhead; (jp = *jpp); jpp = &jp->j_next) {
+		if (jp->j_pid == pid)
+			break;
+	}
+	if (!jp)
+		return;
+	*jpp = jp->j_next;
+	np = jp->j_name;
+	free(jp);
+
+	if (tokens) {
+		xwrite(jobserver[1], "+", 1);
+		tokens--;
+	}
+
+	if (!WIFEXITED(status) ||
+			(WEXITSTATUS(status) & ~(MAKE_FAILURE | MAKE_DIDSOMETHING))
+				!= JOB_EXIT) {
+		// The job has reported the error.  Let the others finish.
+		finish_jobs();
+		exit(2);
+	}
+
+	np->n_flag = (np->n_flag & ~N_RUNNING) | N_DONE;
+	np->n_estat |= WEXITSTATUS(status) & ~JOB_EXIT;
+	if (np->n_estat & MAKE_DIDSOMETHING)
+		update_mtime(np);
+}
+
+/*
+ * Run the commands to make a target in a child process.
+ */
+static int
+start_job(struct name *np, struct cmd *cp, char *oodate, char *allsrc,
+		char *dedup, struct name *implicit, const char *tsuff)
+{
+	struct job *jp;
+	char c;
+
+	// Use our implicit job slot or get a token from the jobserver
+	while (jobhead) {
+		if (safe_read(jobserver[0], &c, 1) == 1) {
+			tokens++;
+			break;
+		}
+		wait_job();
+	}
+
+	fflush_all();
+	jp = xzalloc(sizeof(struct job));
+	jp->j_pid = xfork();
+	if (jp->j_pid == 0) {
+		int estat;
+
+		// The jobs and tokens are the parent's
+		jobhead = NULL;
+		tokens = 0;
+		estat = make1(np, cp, oodate, allsrc, dedup, implicit, tsuff);
+		fflush_all();
+		_exit(JOB_EXIT | estat);
+	}
+	jp->j_name = np;
+	jp->j_next = jobhead;
+	jobhead = jp;
+
+	np->n_flag = (np->n_flag & ~N_DONE) | N_RUNNING;
+	return MAKE_PENDING;
+}
+
+/*
+ * Make the prerequisites of a target when running jobs in parallel.
+ * Return MAKE_PENDING if any of them aren't complete.  Prerequisites
+ * following .WAIT aren't started until those preceding it are done.
+ */
+static int
+make_prereqs(struct name *np, struct name *impdep, int level)
+{
+	int estat = 0;
+
+	if (impdep && (np->n_flag & N_DOUBLE))
+		estat |= make(impdep, level + 1);
+
+	for (struct rule *rp = np->n_rule; rp; rp = rp->r_next) {
+		for (struct depend *dp = rp->r_dep; dp; dp = dp->d_next) {
+			if ((dp->d_name->n_flag & N_WAIT)) {
+				if ((estat & MAKE_PENDING))
+					break;
+				continue;
+			}
+			estat |= make(dp->d_name, level + 1);
+		}
+	}
+	return estat & MAKE_PENDING;
+}
+#endif
+
 /*
  * Recursive routine to make a target.
  */
@@ -2858,7 +3073,9 @@ make(struct name *np, int level)
 	int estat = 0;
 
 	if (np->n_flag & N_DONE)
-		return 0;
+		return parallel ? np->n_estat : 0;
+	if (np->n_flag & (N_RUNNING | N_PENDING))
+		return MAKE_PENDING;
 	if (np->n_flag & N_DOING)
 		error("circular dependency for %s", np->n_name);
 	np->n_flag |= N_DOING;
@@ -2875,7 +3092,13 @@ make(struct name *np, int level)
 			impdep = dyndep(np, &infrule, &tsuff);
 			if (impdep) {
 				sc_cmd = infrule.r_cmd;
-				addrule(np, infrule.r_dep, NULL, FALSE);
+				// A target waiting for a job may be looked at again
+				if (!(np->n_flag & N_INFERRED)) {
+					addrule(np, infrule.r_dep, NULL, FALSE);
+					np->n_flag |= N_INFERRED;
+				} else {
+					freedeps(infrule.r_dep);
+				}
 			}
 		}
 
@@ -2909,6 +3132,15 @@ make(struct name *np, int level)
 		}
 	}
 
+#if !ENABLE_PLATFORM_MINGW32
+	if (parallel && make_prereqs(np, impdep, level)) {
+		if ((np->n_flag & N_DOUBLE) && impdep)
+			free(infrule.r_dep);
+		np->n_flag = (np->n_flag & ~N_DOING) | N_PENDING;
+		return MAKE_PENDING;
+	}
+#endif
+
 	// Reset flag to detect duplicate prerequisites
 	if (!(np->n_flag & N_DOUBLE)) {
 		for (rp = np->n_rule; rp; rp = rp->r_next) {
@@ -2942,6 +3174,9 @@ make(struct name *np, int level)
 			}
 		}
 		for (dp = rp->r_dep; dp; dp = dp->d_next) {
+			if ((dp->d_name->n_flag & N_WAIT))
+				continue;
+
 			// Make prerequisite
 			estat |= make(dp->d_name, level + 1);
 
@@ -2961,6 +3196,12 @@ make(struct name *np, int level)
 		if ((np->n_flag & N_DOUBLE)) {
 			if (((np->n_flag & N_PHONY) || timespec_le(&np->n_tim, &dtim))) {
 				if (!(estat & MAKE_FAILURE)) {
+#if !ENABLE_PLATFORM_MINGW32
+					// Double-colon rules are run by make itself
+					// after any running jobs have finished.
+					while (jobhead)
+						wait_job();
+#endif
 					estat |= make1(np, rp->r_cmd, oodate, allsrc,
 										dedup, locdep, tsuff);
 					dtim = (struct timespec){1, 0};
@@ -2986,6 +3227,12 @@ make(struct name *np, int level)
 	if (!(np->n_flag & N_DOUBLE) &&
 				((np->n_flag & N_PHONY) || (timespec_le(&np->n_tim, &dtim)))) {
 		if (!(estat & MAKE_FAILURE)) {
+#if !ENABLE_PLATFORM_MINGW32
+			if (sc_cmd && parallel)
+				estat |= start_job(np, sc_cmd, oodate, allsrc, dedup,
+								impdep, tsuff);
+			else
+#endif
 			if (sc_cmd)
 				estat |= make1(np, sc_cmd, oodate, allsrc, dedup,
 								impdep, tsuff);
@@ -2997,12 +3244,14 @@ make(struct name *np, int level)
 		free(oodate);
 	}
 
-	if (estat & MAKE_DIDSOMETHING) {
-		modtime(np);
-		if (!np->n_tim.tv_sec)
-			clock_gettime(CLOCK_REALTIME, &np->n_tim);
-	} else if (!quest && level == 0 && !timespec_le(&np->n_tim, &dtim))
-		printf("%s: '%s' is up to date\n", applet_name, np->n_name);
+	// If a job was started its status is added when it finishes
+	np->n_estat = estat & ~MAKE_PENDING;
+	if (!(estat & MAKE_PENDING)) {
+		if (estat & MAKE_DIDSOMETHING)
+			update_mtime(np);
+		else if (!quest && level == 0 && !timespec_le(&np->n_tim, &dtim))
+			printf("%s: '%s' is up to date\n", applet_name, np->n_name);
+	}
 
 	free(allsrc);
 	free(dedup);
@@ -3013,6 +3262,49 @@ make(struct name *np, int level)
  * Check structures for make.
  */
 
+/*
+ * Make the targets given on the command line or, if there are none,
+ * the first target in the makefile.  When jobs are run in parallel
+ * each pass through the dependency tree starts any jobs whose
+ * prerequisites are complete, then waits for a job to finish.
+ */
+static int
+make_targets(char **argv)
+{
+	int estat;
+	bool found_target;
+
+#if !ENABLE_PLATFORM_MINGW32
+ again:
+#endif
+	estat = 0;
+	found_target = FALSE;
+	for (char **a = argv; *a; a++) {
+		// Skip macro assignments.
+		if (strchr(*a, '='))
+			continue;
+		found_target = TRUE;
+		estat |= make(newname(*a), 0);
+	}
+	if (!found_target) {
+		if (!firstname)
+			error("no targets defined");
+		estat = make(firstname, 0);
+	}
+
+#if !ENABLE_PLATFORM_MINGW32
+	if (estat & MAKE_PENDING) {
+		wait_job();
+		for (int i = 0; i < HTABSIZE; i++) {
+			for (struct name *np = namehead[i]; np; np = np->n_next)
+				np->n_flag &= ~N_PENDING;
+		}
+		goto again;
+	}
+#endif
+	return estat;
+}
+
 static void
 print_name(struct name *np)
 {
@@ -3543,20 +3835,13 @@ int make_main(int argc UNUSED_PARAM, char **argv)
 		}
 	}
 
-	estat = 0;
-	found_target = FALSE;
-	for (; *argv; argv++) {
-		// Skip macro assignments.
-		if (strchr(*argv, '='))
-			continue;
-		found_target = TRUE;
-		estat |= make(newname(*argv), 0);
-	}
-	if (!found_target) {
-		if (!firstname)
-			error("no targets defined");
-		estat = make(firstname, 0);
-	}
+#if !ENABLE_PLATFORM_MINGW32
+	if (numjobs > 1 && !dryrun && !quest && !dotouch &&
+			!findname(".NOTPARALLEL"))
+		init_jobserver();
+#endif
+
+	estat = make_targets(argv);
 
 #if ENABLE_FEATURE_CLEAN_UP
 	freenames();
@@ -0,0 +1,60 @@
+#!/bin/sh
+#
+# awk benchmark: typical one-liners over generated log-like input.
+#
+# Usage: awkbench.sh [-n LINES] BUSYBOX [BUSYBOX_OR_AWK...]
+# Runs each workload with every given binary (e.g. an old and a new
+# busybox build, or gawk/mawk for reference), checks that all of them
+# print the same result and reports elapsed wall-clock time.
+
+lines=1000000
+if test x"$1" = x"-n"; then
+	lines=$2
+	shift 2
+fi
+if test $# = 0; then
+	echo "Usage: ${0##*/} [-n LINES] BUSYBOX [BUSYBOX_OR_AWK...]" >&2
+	exit 1
+fi
+
+tmp=${TMPDIR:-/tmp}/awkbench.$$
+trap 'rm -f "$tmp"' EXIT
+
+run() {
+	# $1: binary, rest: awk arguments
+	b=$1
+	shift
+	case ${b##*/} in
+	*awk) "$b" "$@" ;;
+	*) "$b" awk "$@" ;;
+	esac
+}
+
+# host, status, bytes, ms, path: 5 columns, numbers and words
+run "$1" -v n="$lines" 'BEGIN {
+	srand(1)
+	for (i = 0; i < n; i++)
+		printf "host%d %d %d %.3f /p/%d/item%d\n", int(rand() * 500),
+			200 + int(rand() * 4) * 100, int(rand() * 100000),
+			rand() * 2, int(rand() * 50), i % 1000
+}' >"$tmp"
+
+. "${0%/*}/bench_lib.sh"
+binaries="$*"
+bench_run() {
+	run "$1" "$2" "$tmp"
+}
+
+bench "sum column" '{ s += $3 } END { print s }'
+bench "count by key" '{ c[$1]++ } END { for (k in c) n++; print n, c["host7"] }'
+bench "sum by key" '{ s[$2] += $4 } END { print s[200], s[300], s[400], s[500] }'
+bench "filter" '$2 == 404 && $3 > 50000 { n++ } END { print n }'
+bench "FS char" 'BEGIN { FS = "1" } { n += NF } END { print n }'
+bench "FS string" 'BEGIN { FS = "/item" } { s += $2 } END { print s }'
+bench "print fields" '{ print $1, $3 * 2, NR }'
+bench "int to string" '{ k = k + length(NR $3) } END { print k }'
+bench "dynamic regex" 'BEGIN { p = "/[12]+/item9"; s = "/+" }
+	$5 ~ p { n++ } { k += split($5, a, s) } END { print n, k }'
+bench "arith loop" 'BEGIN { for (i = 0; i < 3000000; i++) s += i * i % 7; print s }'
+
+exit $fail
@@ -0,0 +1,39 @@
+#!/bin/sh
+#
+# bc/dc arbitrary precision benchmark.
+#
+# Usage: bcbench.sh BUSYBOX [BUSYBOX_OR_BC...]
+# Runs each workload with every given binary (e.g. an old and a new
+# busybox build, or GNU bc for reference), checks that all of them
+# print the same result and reports elapsed wall-clock time.
+
+if test $# = 0; then
+	echo "Usage: ${0##*/} BUSYBOX [BUSYBOX_OR_BC...]" >&2
+	exit 1
+fi
+
+run() {
+	# $1: binary, rest: bc arguments
+	b=$1
+	shift
+	case ${b##*/} in
+	bc|dc) "$b" "$@" ;;
+	*) "$b" bc "$@" ;;
+	esac
+}
+
+. "${0%/*}/bench_lib.sh"
+binaries="$*"
+bench_run() {
+	echo "$2" | run "$1" -l
+}
+
+bench "factorial 5000" \
+	'define f(n){auto r;r=1;while(n>1)r*=n--;return r}; f(5000)'
+bench "2^200000" '2^200000'
+bench "sqrt(2) 5000" 'scale=5000; sqrt(2)'
+bench "pi 2000" 'scale=2000; 4*a(1)'
+bench "e 2000" 'scale=2000; e(1)'
+bench "1/7^9999" 'scale=10000; 1/7^9999'
+
+exit $fail
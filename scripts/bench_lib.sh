@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# Common code of the *bench.sh scripts, to be sourced.
+#
+# The script sets $binaries and defines bench_run(), which runs one
+# workload: bench_run BINARY ARGS... (ARGS as given to bench).
+# "bench NAME ARGS..." then runs it with every binary, reports elapsed
+# wall-clock time and checks that the output is the same as with the
+# first binary. If $bench_mb is set, the throughput for that many MB
+# is shown too. Exit with $fail: 1 if any output differed.
+
+now_ms() {
+	t=$(date +%s%N 2>/dev/null)
+	case $t in
+	*N|'') echo $(($(date +%s) * 1000)) ;;
+	*) echo $((t / 1000000)) ;;
+	esac
+}
+
+fail=0
+bench() {
+	name=$1
+	shift
+	ref=
+	for b in $binaries; do
+		start=$(now_ms)
+		sum=$(bench_run "$b" "$@" 2>&1 | cksum)
+		end=$(now_ms)
+		if test "$bench_mb"; then
+			printf "%-16s %8d ms %6d MB/s  %s\n" "$name" $((end - start)) \
+				$((bench_mb * 1000 / (end - start + 1))) "$b"
+		else
+			printf "%-16s %8d ms  %s\n" "$name" $((end - start)) "$b"
+		fi
+		test -z "$ref" && ref=$sum
+		if test "$sum" != "$ref"; then
+			echo "$name: $b: result differs" >&2
+			fail=1
+		fi
+	done
+}
@@ -0,0 +1,36 @@
+#!/bin/sh
+#
+# CRC32 micro-benchmark: crc32, cksum and gunzip -t on the same data.
+#
+# Usage: crc32bench.sh [-s MB] BUSYBOX [BUSYBOX...]
+# Compare e.g. builds with different CONFIG_CRC32_SMALL/CRC32_HWACCEL.
+# Results of all binaries are checked to be the same.
+
+size=64
+if test x"$1" = x"-s"; then
+	size=$2
+	shift 2
+fi
+if test $# = 0; then
+	echo "Usage: ${0##*/} [-s MB] BUSYBOX [BUSYBOX...]" >&2
+	exit 1
+fi
+
+tmp=${TMPDIR:-/tmp}/crc32bench.$$
+trap 'rm -f "$tmp" "$tmp.gz"' EXIT
+# Mostly incompressible, so gunzip time is not all inflate
+head -c $((size * 1024 * 1024)) /dev/urandom >"$tmp"
+"$1" gzip -1 -c "$tmp" >"$tmp.gz"
+
+. "${0%/*}/bench_lib.sh"
+bench_mb=$size
+bench_run() {
+	"$@"
+}
+
+binaries="$*"
+bench crc32 crc32 "$tmp"
+bench cksum cksum "$tmp"
+bench "gunzip -t" gunzip -t "$tmp.gz"
+
+exit $fail
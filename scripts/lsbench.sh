@@ -0,0 +1,57 @@
+#!/bin/sh
+#
+# ls benchmark: list a directory with many files.
+#
+# Usage: lsbench.sh [-n FILES] [-d DIR] BUSYBOX [BUSYBOX_OR_LS...]
+# Creates FILES empty files (and a few subdirs) in a new directory
+# in DIR (default: $TMPDIR or /tmp; try an NFS mount), runs ls with
+# various options with every given binary, checks that all of them
+# print the same result and reports elapsed wall-clock time.
+
+files=200000
+dir=${TMPDIR:-/tmp}
+while true; do
+	case $1 in
+	-n) files=$2; shift 2 ;;
+	-d) dir=$2; shift 2 ;;
+	*) break ;;
+	esac
+done
+if test $# = 0; then
+	echo "Usage: ${0##*/} [-n FILES] [-d DIR] BUSYBOX [BUSYBOX_OR_LS...]" >&2
+	exit 1
+fi
+
+tmp=$dir/lsbench.$$
+trap 'rm -rf "$tmp"' EXIT
+mkdir "$tmp" || exit 1
+# Create files in batches, a fork per file would take longer than ls
+"$1" seq "$files" | (cd "$tmp" && "$1" xargs touch)
+mkdir "$tmp/dir1" "$tmp/dir2"
+
+run() {
+	# $1: binary, rest: ls arguments
+	b=$1
+	shift
+	case ${b##*/} in
+	ls) "$b" "$@" ;;
+	*) "$b" ls "$@" ;;
+	esac
+}
+
+. "${0%/*}/bench_lib.sh"
+bench_run() {
+	b=$1
+	shift
+	run "$b" "$@" "$tmp"
+}
+
+binaries="$*"
+bench "ls" -1
+bench "ls -R" -1R
+bench "ls -p" -1p
+bench "ls -F" -1F
+bench "ls -l" -ln
+bench "ls -S" -1S
+
+exit $fail
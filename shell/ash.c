@@ -405,6 +405,7 @@ struct forkshell {
 	struct globals_misc *gmp;
 	struct globals_var *gvp;
 	struct tblentry **cmdtable;
+	unsigned cmdtablesize;
 #if ENABLE_ASH_ALIAS
 	struct alias **atab;
 #endif
@@ -470,9 +471,9 @@ static void forkshell_print(FILE *fp0, struct forkshell *fs, const char **notes)
 
 /* ============ Hash table sizes. Configurable. */
 
-#define VTABSIZE 39
+#define VTABSIZE 64             /* initial size, grows; power of 2 */
 #define ATABSIZE 39
-#define CMDTABLESIZE 31         /* should be prime */
+#define CMDTABLESIZE 32         /* initial size, grows; power of 2 */
 
 
 /* ============ Shell options */
@@ -2481,6 +2482,7 @@ static void FAST_FUNC getoptsreset(const char *value);
 
 struct var {
 	struct var *next;               /* next entry in hash list */
+	unsigned hash;                  /* hashvar() of the name */
 	int flags;                      /* flags are defined above */
 	const char *var_text;           /* name=value */
 	void (*var_func)(const char *) FAST_FUNC; /* function to be called when  */
@@ -2609,7 +2611,9 @@ struct globals_var {
 	struct shparam shellparam;      /* $@ current positional parameters */
 	struct redirtab *redirlist;
 	int preverrout_fd;   /* stderr fd: usually 2, unless redirect moved it */
-	struct var *vartab[VTABSIZE];
+	struct var **vartab;
+	unsigned vtabsize;              /* power of 2 */
+	unsigned nvars;
 	struct var varinit[ARRAY_SIZE(varinit_data)];
 	int lineno;
 	char linenovar[sizeof("LINENO=") + sizeof(int)*3];
@@ -2624,6 +2628,8 @@ extern struct globals_var *BB_GLOBAL_CONST ash_ptr_to_globals_var;
 //#define redirlist     (G_var.redirlist    )
 #define preverrout_fd (G_var.preverrout_fd)
 #define vartab        (G_var.vartab       )
+#define vtabsize      (G_var.vtabsize     )
+#define nvars         (G_var.nvars        )
 #define varinit       (G_var.varinit      )
 #define lineno        (G_var.lineno       )
 #define linenovar     (G_var.linenovar    )
@@ -2701,17 +2707,40 @@ getoptsreset(const char *value)
 #endif
 
 /*
- * Find the appropriate entry in the hash table from the name.
+ * Hash a variable name (terminated by '=' or NUL).
  */
-static struct var **
+static unsigned
 hashvar(const char *p)
 {
 	unsigned hashval;
 
 	hashval = ((unsigned char) *p) << 4;
 	while (*p && *p != '=')
-		hashval += (unsigned char) *p++;
-	return &vartab[hashval % VTABSIZE];
+		hashval = hashval * 31 + (unsigned char) *p++;
+	return hashval;
+}
+
+/*
+ * Double the size of the variable hash table.  Chains are relinked
+ * using the cached hash values, variables themselves don't move.
+ */
+static void
+growvartab(void)
+{
+	struct var **newtab, **vpp, *vp, *next;
+	unsigned newsize = vtabsize * 2;
+
+	newtab = ckzalloc(newsize * sizeof(newtab[0]));
+	for (vpp = vartab; vpp < vartab + vtabsize; vpp++) {
+		for (vp = *vpp; vp; vp = next) {
+			next = vp->next;
+			vp->next = newtab[vp->hash & (newsize - 1)];
+			newtab[vp->hash & (newsize - 1)] = vp;
+		}
+	}
+	free(vartab);
+	vartab = newtab;
+	vtabsize = newsize;
 }
 
 static int
@@ -2739,22 +2768,27 @@ initvar(void)
 	if (!get_cached_euid(&groupinfo.euid));
 		vps1.var_text = "PS1=# ";
 #endif
+	vtabsize = VTABSIZE;
+	vartab = ckzalloc(VTABSIZE * sizeof(vartab[0]));
 	vp = varinit;
 	end = vp + ARRAY_SIZE(varinit);
 	do {
-		vpp = hashvar(vp->var_text);
+		vp->hash = hashvar(vp->var_text);
+		vpp = &vartab[vp->hash & (VTABSIZE - 1)];
 		vp->next = *vpp;
 		*vpp = vp;
 	} while (++vp < end);
+	nvars = ARRAY_SIZE(varinit);
 }
 
 static struct var **
 findvar(const char *name)
 {
 	struct var **vpp;
+	unsigned hash = hashvar(name);
 
-	for (vpp = hashvar(name); *vpp; vpp = &(*vpp)->next) {
-		if (varcmp((*vpp)->var_text, name) == 0) {
+	for (vpp = &vartab[hash & (vtabsize - 1)]; *vpp; vpp = &(*vpp)->next) {
+		if ((*vpp)->hash == hash && varcmp((*vpp)->var_text, name) == 0) {
 			break;
 		}
 	}
@@ -2946,6 +2980,7 @@ setvareq(char *s, int flags)
 		if (((flags & (VEXPORT|VREADONLY|VSTRFIXED|VUNSET)) | (vp->flags & VSTRFIXED)) == VUNSET) {
 			*vpp = vp->next;
 			free(vp);
+			nvars--;
  out_free:
 			if ((flags & (VTEXTFIXED|VSTACK|VNOSAVE)) == VNOSAVE)
 				free(s);
@@ -2965,8 +3000,12 @@ setvareq(char *s, int flags)
 			goto out_free;
 		vp = ckzalloc(sizeof(*vp));
 		vp->next = *vpp;
+		vp->hash = hashvar(s);
 		/*vp->func = NULL; - ckzalloc did it */
 		*vpp = vp;
+		/* Keep chains short: grow at load factor 1 */
+		if (++nvars > vtabsize)
+			growvartab();
 	}
 	if (!(flags & (VTEXTFIXED|VSTACK|VNOSAVE)))
 		s = ckstrdup(s);
@@ -3078,7 +3117,7 @@ listvars(int on, int off, struct strlist *lp, char ***end)
 #endif
 			}
 		}
-	} while (++vpp < vartab + VTABSIZE);
+	} while (++vpp < vartab + vtabsize);
 
 #if ENABLE_FEATURE_SH_NOFORK
 	while (lp) {
@@ -3110,7 +3149,7 @@ setwinxp(int on)
 		return;
 	is_winxp = on;
 
-	for (vpp = vartab; vpp < vartab + VTABSIZE; vpp++) {
+	for (vpp = vartab; vpp < vartab + vtabsize; vpp++) {
 		for (vp = *vpp; vp; vp = vp->next) {
 			if ((vp->flags & VIMPORT)) {
 				char *end = strchr(vp->var_text, '=');
@@ -9499,6 +9538,7 @@ struct tblentry {
 #define CMDNORMAL       0       /* command is an executable program */
 #define CMDFUNCTION     1       /* command is a shell function */
 #define CMDBUILTIN      2       /* command is a shell builtin */
+#define CMDMISSING      3       /* command was not found in PATH */
 
 struct cmdentry {
 	smallint cmdtype;       /* CMDxxx */
@@ -9506,10 +9546,21 @@ struct cmdentry {
 };
 
 static struct tblentry **cmdtable;
+static unsigned cmdtablesize;   /* power of 2 */
+static unsigned ncmdentries;
 #define INIT_G_cmdtable() do { \
+	cmdtablesize = CMDTABLESIZE; \
 	cmdtable = xzalloc(CMDTABLESIZE * sizeof(cmdtable[0])); \
 } while (0)
 
+/*
+ * CMDMISSING entries stay valid while no directory in PATH changes.
+ * pathmtime[] holds the directory mtimes, recorded before any of
+ * those entries were made.
+ */
+static time_t *pathmtime;
+static int npathmtime = -1;     /* -1: not recorded, no CMDMISSING entries */
+
 static int builtinloc = -1;     /* index in path of %builtin, or -1 */
 
 static void
@@ -9542,10 +9593,11 @@ clearcmdentry(void)
 	struct tblentry *cmdp;
 
 	INTOFF;
-	for (tblp = cmdtable; tblp < &cmdtable[CMDTABLESIZE]; tblp++) {
+	for (tblp = cmdtable; tblp < &cmdtable[cmdtablesize]; tblp++) {
 		pp = tblp;
 		while ((cmdp = *pp) != NULL) {
 			if (cmdp->cmdtype == CMDNORMAL
+			 || cmdp->cmdtype == CMDMISSING
 			 || (cmdp->cmdtype == CMDBUILTIN
 			    && !IS_BUILTIN_REGULAR(cmdp->param.cmd)
 			    && builtinloc > 0
@@ -9553,14 +9605,130 @@ clearcmdentry(void)
 			) {
 				*pp = cmdp->next;
 				free(cmdp);
+				ncmdentries--;
 			} else {
 				pp = &cmdp->next;
 			}
 		}
 	}
+	npathmtime = -1;
 	INTON;
 }
 
+/*
+ * Forget all CMDMISSING entries.
+ */
+static void
+clearmissing(void)
+{
+	struct tblentry **tblp;
+	struct tblentry **pp;
+	struct tblentry *cmdp;
+
+	INTOFF;
+	for (tblp = cmdtable; tblp < &cmdtable[cmdtablesize]; tblp++) {
+		pp = tblp;
+		while ((cmdp = *pp) != NULL) {
+			if (cmdp->cmdtype == CMDMISSING) {
+				*pp = cmdp->next;
+				free(cmdp);
+				ncmdentries--;
+			} else {
+				pp = &cmdp->next;
+			}
+		}
+	}
+	npathmtime = -1;
+	INTON;
+}
+
+/*
+ * Record modification times of PATH directories.  If one of them was
+ * modified within the current second, a later change in the same second
+ * would go unnoticed: don't record anything then.
+ */
+static void
+savepathmtime(void)
+{
+	const char *path = pathval();
+	struct stat statb;
+	time_t now = time(NULL);
+	time_t mt;
+	int n = 0;
+
+	INTOFF;
+	while (padvance(&path, ".") >= 0) {
+		mt = stat(stackblock(), &statb) == 0 ? statb.st_mtime : 0;
+		if (mt >= now)
+			goto ret;
+		pathmtime = ckrealloc(pathmtime, (n + 1) * sizeof(pathmtime[0]));
+		pathmtime[n++] = mt;
+	}
+	npathmtime = n;
+ ret:
+	INTON;
+}
+
+/*
+ * Are CMDMISSING entries still good?  If not, drop them.
+ */
+static int
+pathmtime_valid(void)
+{
+	const char *path = pathval();
+	struct stat statb;
+	time_t mt;
+	int n = 0;
+
+	if (npathmtime < 0)
+		goto bad;
+	while (padvance(&path, ".") >= 0) {
+		mt = stat(stackblock(), &statb) == 0 ? statb.st_mtime : 0;
+		if (n >= npathmtime || pathmtime[n++] != mt)
+			goto bad;
+	}
+	if (n == npathmtime)
+		return 1;
+ bad:
+	clearmissing();
+	return 0;
+}
+
+static unsigned
+cmdhash(const char *p)
+{
+	unsigned hashval;
+
+	hashval = (unsigned char)*p << 4;
+	while (*p)
+		hashval = hashval * 31 + (unsigned char)*p++;
+	return hashval;
+}
+
+/*
+ * Double the size of the command hash table.
+ */
+static void
+growcmdtable(void)
+{
+	struct tblentry **newtab, **pp, *cmdp, *next;
+	unsigned newsize = cmdtablesize * 2;
+	unsigned h;
+
+	newtab = ckzalloc(newsize * sizeof(newtab[0]));
+	for (pp = cmdtable; pp < &cmdtable[cmdtablesize]; pp++) {
+		for (cmdp = *pp; cmdp; cmdp = next) {
+			next = cmdp->next;
+			h = cmdhash(cmdp->cmdname) & (newsize - 1);
+			cmdp->next = newtab[h];
+			newtab[h] = cmdp;
+		}
+	}
+	free(cmdtable);
+	cmdtable = newtab;
+	cmdtablesize = newsize;
+}
+
 /*
  * Locate a command in the command hash table.  If "add" is nonzero,
  * add the command to the table if it is not already present.
@@ -9571,16 +9739,11 @@ static struct tblentry **
 cmdlookup_pp(const char *name, int add)
 {
 	unsigned int hashval;
-	const char *p;
 	struct tblentry *cmdp;
 	struct tblentry **pp;
 
-	p = name;
-	hashval = (unsigned char)*p << 4;
-	while (*p)
-		hashval += (unsigned char)*p++;
-	hashval &= 0x7FFF;
-	pp = &cmdtable[hashval % CMDTABLESIZE];
+	hashval = cmdhash(name);
+	pp = &cmdtable[hashval & (cmdtablesize - 1)];
 	for (;;) {
 		cmdp = *pp;
 		if (!cmdp)
@@ -9590,13 +9753,18 @@ cmdlookup_pp(const char *name, int add)
 		pp = &cmdp->next;
 	}
 	if (add) {
-		cmdp = *pp = ckzalloc(sizeof(struct tblentry)
+		if (++ncmdentries > cmdtablesize) {
+			growcmdtable();
+			pp = &cmdtable[hashval & (cmdtablesize - 1)];
+		}
+		cmdp = ckzalloc(sizeof(struct tblentry)
 				+ strlen(name)
 				/* + 1 - already done because
 				 * tblentry::cmdname is char[1] */);
-		/*cmdp->next = NULL; - ckzalloc did it */
+		cmdp->next = *pp;
 		cmdp->cmdtype = CMDUNKNOWN;
 		strcpy(cmdp->cmdname, name);
+		*pp = cmdp;
 	}
  ret:
 	return pp;
@@ -9622,6 +9790,7 @@ delete_cmd_entry(struct tblentry **pp)
 	if (cmdp->cmdtype == CMDFUNCTION)
 		freefunc(cmdp->param.func);
 	free(cmdp);
+	ncmdentries--;
 	INTON;
 }
 
@@ -9653,7 +9822,10 @@ hashcd(void)
 	struct tblentry **pp;
 	struct tblentry *cmdp;
 
-	for (pp = cmdtable; pp < &cmdtable[CMDTABLESIZE]; pp++) {
+	/* relative PATH entries now refer to other directories */
+	if (npathmtime >= 0)
+		clearmissing();
+	for (pp = cmdtable; pp < &cmdtable[cmdtablesize]; pp++) {
 		for (cmdp = *pp; cmdp; cmdp = cmdp->next) {
 			if (cmdp->cmdtype == CMDNORMAL
 			 || (cmdp->cmdtype == CMDBUILTIN
@@ -9769,6 +9941,7 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 	int updatetbl;
 	const struct builtincmd *bcmd;
 	int len;
+	int missing;
 
 #if !ENABLE_PLATFORM_MINGW32
 	/* If name contains a slash, don't use PATH or hash table */
@@ -9838,6 +10011,7 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 			abort();
 #endif
 		case CMDNORMAL:
+		case CMDMISSING:
 			bit = DO_ALTPATH | DO_REGBLTIN;
 			break;
 		case CMDFUNCTION:
@@ -9852,6 +10026,12 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 				goto fail;
 			updatetbl = 0;
 			cmdp = NULL;
+		} else if (cmdp->cmdtype == CMDMISSING) {
+			e = ENOENT;
+			if (pathmtime_valid())
+				goto notfound;
+			/* the entry is gone, search PATH again */
+			cmdp = NULL;
 		} else if (cmdp->rehash == 0)
 			/* if not invalidated by cd, we're done */
 			goto success1;
@@ -9884,6 +10064,9 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 	}
 #endif
 	/* We have to search path. */
+	if (updatetbl && npathmtime < 0)
+		savepathmtime();
+	missing = 1;
 	prev = -1;              /* where to start */
 	if (cmdp /*TRUE: && cmdp->rehash*/) {
 		/* doing a rehash */
@@ -9930,6 +10113,10 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 #endif
 			if (errno != ENOENT && errno != ENOTDIR)
 				e = errno;
+			/* A dangling symlink may start working without
+			 * its directory changing: don't remember the miss */
+			else if (lstat(fullname, &statb) == 0)
+				missing = 0;
 			goto loop;
 		}
 		if (lpathopt) {          /* this is a %func directory */
@@ -9961,9 +10148,20 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 		goto success;
 	}
 
-	/* We failed.  If there was an entry for this command, delete it */
-	if (cmdp && updatetbl)
-		delete_cmd_entry(cmdpp);
+	/* We failed.  Remember that if we can: scripts often probe for
+	 * optional commands.  Otherwise delete any entry for this command. */
+	if (updatetbl) {
+		if (e == ENOENT && missing && npathmtime >= 0) {
+			INTOFF;
+			cmdp = cmdlookup(name, 1);
+			cmdp->cmdtype = CMDMISSING;
+			cmdp->rehash = 0;
+			INTON;
+		} else if (cmdp) {
+			delete_cmd_entry(cmdpp);
+		}
+	}
+ notfound:
 	if (act & DO_ERR) {
 #if ENABLE_ASH_BASH_NOT_FOUND_HOOK
 		struct tblentry *hookp = cmdlookup("command_not_found_handle", 0);
@@ -11940,7 +12138,7 @@ hashcmd(int argc UNUSED_PARAM, char **argv UNUSED_PARAM)
 	}
 
 	if (*argptr == NULL) {
-		for (pp = cmdtable; pp < &cmdtable[CMDTABLESIZE]; pp++) {
+		for (pp = cmdtable; pp < &cmdtable[cmdtablesize]; pp++) {
 			for (cmdp = *pp; cmdp; cmdp = cmdp->next) {
 				if (cmdp->cmdtype == CMDNORMAL)
 					printentry(cmdp);
@@ -12173,7 +12371,7 @@ ash_command_name(int i)
 		return builtintab[i].name;
 	i -= ARRAY_SIZE(builtintab);
 
-	for (n = 0; n < CMDTABLESIZE; n++) {
+	for (n = 0; n < cmdtablesize; n++) {
 		struct tblentry *cmdp;
 		for (cmdp = cmdtable[n]; cmdp; cmdp = cmdp->next) {
 			if (cmdp->cmdtype == CMDFUNCTION && --i < 0)
@@ -17065,6 +17263,10 @@ reinitvar(void)
 	const char *name;
 	struct var **old;
 
+	/* The table itself is in the forkshell block, it may need to grow */
+	vartab = memcpy(ckmalloc(vtabsize * sizeof(vartab[0])), vartab,
+			vtabsize * sizeof(vartab[0]));
+
 	for (i=0; i<ARRAY_SIZE(varinit); ++i) {
 		if (i == LINENO_INDEX)
 			name = "LINENO=";
@@ -17189,6 +17391,7 @@ SLIST_SIZE_END()
 
 SLIST_COPY_BEGIN(var_copy,struct var)
 (*vpp)->var_text = nodeckstrdup(vp->var_text);
+(*vpp)->hash = vp->hash;
 (*vpp)->flags = vp->flags;
 (*vpp)->var_func = NULL;
 SAVE_PTR((*vpp)->var_text, xasprintf("(*vpp)->var_text '%s'", vp->var_text ?: "NULL"), FREE);
@@ -17200,14 +17403,16 @@ SLIST_COPY_END()
 static struct datasize
 tblentry_size(struct datasize ds, struct tblentry *tep)
 {
-	while (tep) {
+	for (; tep; tep = tep->next) {
+		/* the child doesn't inherit pathmtime[] */
+		if (tep->cmdtype == CMDMISSING)
+			continue;
 		ds.funcblocksize += sizeof(struct tblentry) + align_len(tep->cmdname);
 		/* CMDBUILTIN, e->param.cmd needs no pointer relocation */
 		if (tep->cmdtype == CMDFUNCTION) {
 			ds.funcblocksize += offsetof(struct funcnode, n);
 			ds.funcblocksize = calcsize(ds.funcblocksize, &tep->param.func->n);
 		}
-		tep = tep->next;
 	}
 	return ds;
 }
@@ -17220,7 +17425,9 @@ tblentry_copy(struct tblentry *tep)
 	int size;
 
 	newp = &start;
-	while (tep) {
+	for (; tep; tep = tep->next) {
+		if (tep->cmdtype == CMDMISSING)
+			continue;
 		*newp = funcblock;
 		size = sizeof(struct tblentry) + align_len(tep->cmdname);
 
@@ -17241,7 +17448,6 @@ tblentry_copy(struct tblentry *tep)
 			break;
 		}
 		SAVE_PTR((*newp)->next, xasprintf("cmdname '%s'", tep->cmdname), FREE);
-		tep = tep->next;
 		newp = &(*newp)->next;
 	}
 	*newp = NULL;
@@ -17251,9 +17457,9 @@ tblentry_copy(struct tblentry *tep)
 static struct datasize
 cmdtable_size(struct datasize ds)
 {
-	int i;
-	ds.funcblocksize += sizeof(struct tblentry *)*CMDTABLESIZE;
-	for (i = 0; i < CMDTABLESIZE; i++)
+	unsigned i;
+	ds.funcblocksize += sizeof(struct tblentry *)*cmdtablesize;
+	for (i = 0; i < cmdtablesize; i++)
 		ds = tblentry_size(ds, cmdtable[i]);
 	return ds;
 }
@@ -17262,10 +17468,10 @@ static struct tblentry **
 cmdtable_copy(void)
 {
 	struct tblentry **new = funcblock;
-	int i;
+	unsigned i;
 
-	funcblock = (char *) funcblock + sizeof(struct tblentry *)*CMDTABLESIZE;
-	for (i = 0; i < CMDTABLESIZE; i++) {
+	funcblock = (char *) funcblock + sizeof(struct tblentry *)*cmdtablesize;
+	for (i = 0; i < cmdtablesize; i++) {
 		new[i] = tblentry_copy(cmdtable[i]);
 		SAVE_PTR(new[i], xasprintf("cmdtable[%d]", i), FREE);
 	}
@@ -17511,13 +17717,14 @@ redirtab_copy(struct redirtab *rdtp)
 static struct datasize
 globals_var_size(struct datasize ds)
 {
-	int i;
+	unsigned i;
 
 	ds.funcblocksize += sizeof(struct globals_var);
 	ds.funcstringsize += align_len(funcname);
 	ds = argv_size(ds, shellparam.p);
 	ds.funcblocksize = redirtab_size(ds.funcblocksize, redirlist);
-	for (i = 0; i < VTABSIZE; i++)
+	ds.funcblocksize += vtabsize * sizeof(vartab[0]);
+	for (i = 0; i < vtabsize; i++)
 		ds = var_size(ds, vartab[i]);
 	return ds;
 }
@@ -17529,7 +17736,7 @@ globals_var_size(struct datasize ds)
 static struct globals_var *
 globals_var_copy(void)
 {
-	int i;
+	unsigned i;
 	struct globals_var *gvp, *new;
 
 	gvp = ash_ptr_to_globals_var;
@@ -17548,7 +17755,10 @@ globals_var_copy(void)
 	new->redirlist = redirtab_copy(gvp->redirlist);
 	SAVE_PTR(new->redirlist, "redirlist", NO_FREE);
 
-	for (i = 0; i < VTABSIZE; i++) {
+	new->vartab = funcblock;
+	funcblock = (char *) funcblock + gvp->vtabsize * sizeof(new->vartab[0]);
+	SAVE_PTR(new->vartab, "vartab", NO_FREE);
+	for (i = 0; i < gvp->vtabsize; i++) {
 		new->vartab[i] = var_copy(gvp->vartab[i]);
 		SAVE_PTR(new->vartab[i], xasprintf("vartab[%d]", i), FREE);
 	}
@@ -17658,6 +17868,7 @@ forkshell_copy(struct forkshell *fs, struct forkshell *new)
 	new->gmp = globals_misc_copy();
 	new->gvp = globals_var_copy();
 	new->cmdtable = cmdtable_copy();
+	new->cmdtablesize = cmdtablesize;
 	SAVE_PTR(new->gmp, "gmp", NO_FREE);
 	SAVE_PTR(new->gvp, "gvp", NO_FREE);
 	SAVE_PTR(new->cmdtable, "cmdtable", NO_FREE);
@@ -17931,11 +18142,12 @@ forkshell_init(const char *idstr)
 		goto end;
 
 	/* Now fix up stuff that can't be transferred */
-	for (i = 0; i < CMDTABLESIZE; i++) {
+	for (i = 0; i < fs->cmdtablesize; i++) {
 		struct tblentry *e = fs->cmdtable[i];
 		while (e) {
 			if (e->cmdtype == CMDBUILTIN)
 				e->param.cmd = builtintab + e->param.index;
+			ncmdentries++;
 			e = e->next;
 		}
 	}
@@ -17949,7 +18161,10 @@ forkshell_init(const char *idstr)
 	/* Set global variables */
 	ASSIGN_CONST_PTR(&ash_ptr_to_globals_misc, fs->gmp);
 	ASSIGN_CONST_PTR(&ash_ptr_to_globals_var, fs->gvp);
-	cmdtable = fs->cmdtable;
+	/* the table may need to grow: move it out of the forkshell block */
+	cmdtablesize = fs->cmdtablesize;
+	cmdtable = memcpy(ckmalloc(cmdtablesize * sizeof(cmdtable[0])),
+			fs->cmdtable, cmdtablesize * sizeof(cmdtable[0]));
 #if ENABLE_ASH_ALIAS
 	atab = fs->atab;	/* will be NULL for FS_SHELLEXEC */
 #endif